@@ -0,0 +1,204 @@
+// Compares CompleterMap with the double hashing map it replaced, using the access pattern IoQueue
+// produces: a roughly constant number of operations is in flight, every new operation inserts a
+// key and every completion removes one. Completions arrive mostly, but not entirely, in order.
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <limits>
+#include <optional>
+#include <utility>
+#include <vector>
+
+#include "aiopp/completermap.hpp"
+
+using namespace aiopp;
+
+// This is the CompleterMap this repository used before (without get).
+class DoubleHashingMap {
+public:
+    DoubleHashingMap(size_t numEntries)
+        : entries_(getNextSize(numEntries))
+    {
+    }
+
+    void insert(uint64_t key, void* value)
+    {
+        assert(size_ < entries_.size());
+        const auto h = (hash(key) % (entries_.size() - 1)) + 1;
+        for (size_t i = 0; i < entries_.size(); ++i) {
+            auto& entry = entries_[(key + i * h) % entries_.size()];
+            if (entry.value == Empty || entry.value == Tombstone) {
+                entry.key = key;
+                entry.value = value;
+                size_++;
+                return;
+            }
+        }
+        std::abort();
+    }
+
+    void* remove(uint64_t key)
+    {
+        const auto idx = lookup(key);
+        if (!idx) {
+            return nullptr;
+        }
+        const auto value = entries_[*idx].value;
+        entries_[*idx].value = Tombstone;
+        size_--;
+        return value;
+    }
+
+private:
+    static constexpr void* Empty = nullptr;
+    static inline void* Tombstone = reinterpret_cast<void*>(std::numeric_limits<uintptr_t>::max());
+
+    struct Entry {
+        uint64_t key = std::numeric_limits<uint64_t>::max();
+        void* value = nullptr;
+    };
+
+    static uint64_t hash(uint64_t x)
+    {
+        x ^= x >> 30;
+        x *= 0xbf58476d1ce4e5b9U;
+        x ^= x >> 27;
+        x *= 0x94d049bb133111ebU;
+        x ^= x >> 31;
+        return x;
+    }
+
+    static size_t getNextSize(size_t num)
+    {
+        static constexpr auto primes = std::to_array<size_t>(
+            { 53, 97, 193, 389, 769, 1543, 3079, 6151, 12289, 24593, 49157, 98317, 196613 });
+        for (const auto prime : primes) {
+            if (num < prime) {
+                return prime;
+            }
+        }
+        std::abort();
+    }
+
+    std::optional<size_t> lookup(uint64_t key) const
+    {
+        const auto h = (hash(key) % (entries_.size() - 1)) + 1;
+        for (size_t i = 0; i < entries_.size(); ++i) {
+            const auto idx = (key + i * h) % entries_.size();
+            auto& entry = entries_[idx];
+            if (entry.value == Empty) {
+                return std::nullopt;
+            } else if (entry.value != Tombstone && entry.key == key) {
+                return idx;
+            }
+        }
+        return std::nullopt;
+    }
+
+    std::vector<Entry> entries_;
+    size_t size_ = 0;
+};
+
+// The keys of the operations in flight in order of submission. Completions are taken from
+// somewhere near the front, so they are mostly in order of submission.
+class InFlight {
+public:
+    InFlight(size_t size)
+        : keys_(std::bit_ceil(size + 1))
+    {
+    }
+
+    void push(uint64_t key)
+    {
+        keys_[end_ & (keys_.size() - 1)] = key;
+        end_++;
+    }
+
+    uint64_t popCompleted()
+    {
+        // xorshift64, because std::uniform_int_distribution would dominate the measurement
+        rngState_ ^= rngState_ << 13;
+        rngState_ ^= rngState_ >> 7;
+        rngState_ ^= rngState_ << 17;
+        const auto window = std::min<size_t>(end_ - start_, 8);
+        const auto mask = keys_.size() - 1;
+        auto& front = keys_[start_ & mask];
+        std::swap(front, keys_[(start_ + rngState_ % window) & mask]);
+        start_++;
+        return front;
+    }
+
+private:
+    std::vector<uint64_t> keys_;
+    size_t start_ = 0;
+    size_t end_ = 0;
+    uint64_t rngState_ = 42;
+};
+
+template <typename Func>
+double measureNsPerOp(size_t numOps, Func func)
+{
+    const auto start = std::chrono::steady_clock::now();
+    func();
+    const auto dur = std::chrono::steady_clock::now() - start;
+    return std::chrono::duration<double, std::nano>(dur).count() / numOps;
+}
+
+void* value(uint64_t i)
+{
+    return reinterpret_cast<void*>(i + 1);
+}
+
+double benchDoubleHashing(size_t capacity, size_t inFlightOps, size_t numOps)
+{
+    DoubleHashingMap map(capacity);
+    InFlight inFlight(inFlightOps + 1);
+    uint64_t nextKey = 0;
+    for (size_t i = 0; i < inFlightOps; ++i) {
+        map.insert(nextKey, value(nextKey));
+        inFlight.push(nextKey++);
+    }
+    return measureNsPerOp(numOps, [&]() {
+        for (size_t i = 0; i < numOps; ++i) {
+            map.insert(nextKey, value(nextKey));
+            inFlight.push(nextKey++);
+            if (!map.remove(inFlight.popCompleted())) {
+                std::abort();
+            }
+        }
+    });
+}
+
+double benchCompleterMap(size_t capacity, size_t inFlightOps, size_t numOps)
+{
+    CompleterMap map(capacity);
+    InFlight inFlight(inFlightOps + 1);
+    for (size_t i = 0; i < inFlightOps; ++i) {
+        inFlight.push(map.insert(value(i)));
+    }
+    return measureNsPerOp(numOps, [&]() {
+        for (size_t i = 0; i < numOps; ++i) {
+            inFlight.push(map.insert(value(i)));
+            if (!map.remove(inFlight.popCompleted())) {
+                std::abort();
+            }
+        }
+    });
+}
+
+int main(int argc, char** argv)
+{
+    const size_t numOps = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 10'000'000;
+    const size_t capacity = 4096;
+    std::printf("%zu insert/remove pairs, capacity %zu\n", numOps, capacity);
+    std::printf("%10s %18s %18s\n", "in flight", "double hashing", "CompleterMap");
+    for (const size_t inFlightOps : { 16, 256, 1024, 2048, 3072 }) {
+        const auto dh = benchDoubleHashing(capacity, inFlightOps, numOps);
+        const auto cm = benchCompleterMap(capacity, inFlightOps, numOps);
+        std::printf("%10zu %15.2f ns %15.2f ns\n", inFlightOps, dh, cm);
+    }
+}
@@ -0,0 +1,169 @@
+// Runs a minimal echo server (a plain recv/send loop with a 64 byte buffer, without the deadlines
+// of echo-tcp-coro, so only the ring setup differs) with every IoQueue::Options mode on a thread of
+// its own and measures round trips per second of a number of TCP connections over loopback. The
+// client side always uses the default options.
+// Usage: bench-ioqueue-modes [connections] [round trips per connection]
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#include "aiopp/basiccoroutine.hpp"
+#include "aiopp/ioqueue.hpp"
+#include "aiopp/socket.hpp"
+
+using namespace aiopp;
+
+struct Mode {
+    std::string name;
+    IoQueue::Options options;
+};
+
+std::vector<Mode> getModes()
+{
+    std::vector<Mode> modes;
+    modes.push_back({ "default", {} });
+
+    IoQueue::Options sqPoll;
+    sqPoll.submissionQueuePolling = true;
+    modes.push_back({ "sqpoll", sqPoll });
+
+    IoQueue::Options sqPollPinned = sqPoll;
+    sqPollPinned.sqPollCpu = 0;
+    sqPollPinned.sqPollIdle = std::chrono::milliseconds(100);
+    modes.push_back({ "sqpoll cpu=0 idle=100ms", sqPollPinned });
+
+    IoQueue::Options singleIssuer;
+    singleIssuer.singleIssuer = true;
+    modes.push_back({ "single_issuer", singleIssuer });
+
+    IoQueue::Options deferTaskrun;
+    deferTaskrun.deferTaskrun = true;
+    modes.push_back({ "single_issuer+defer_taskrun", deferTaskrun });
+
+    IoQueue::Options coopTaskrun;
+    coopTaskrun.coopTaskrun = true;
+    modes.push_back({ "coop_taskrun", coopTaskrun });
+
+    IoQueue::Options coopSingleIssuer = coopTaskrun;
+    coopSingleIssuer.singleIssuer = true;
+    modes.push_back({ "coop_taskrun+single_issuer", coopSingleIssuer });
+
+    IoQueue::Options large;
+    large.completionQueueSize = 16 * 1024;
+    large.submitAll = true;
+    modes.push_back({ "cqsize=16k+submit_all", large });
+
+    return modes;
+}
+
+BasicCoroutine echo(IoQueue& io, Fd socket)
+{
+    char buffer[64];
+    while (true) {
+        const auto receivedBytes = co_await io.recv(socket, buffer, sizeof(buffer));
+        if (!receivedBytes || *receivedBytes == 0) {
+            break;
+        }
+        const auto sentBytes = co_await io.send(socket, buffer, *receivedBytes);
+        if (!sentBytes) {
+            break;
+        }
+    }
+    co_await io.close(socket.release());
+}
+
+// Returns once all connections have been accepted, which destroys the accept stream, so run()
+// returns once all connections are closed.
+BasicCoroutine serve(IoQueue& io, const Fd& listenSocket, size_t numConnections)
+{
+    auto connections = io.acceptMultishot(listenSocket);
+    for (size_t i = 0; i < numConnections; ++i) {
+        auto conn = co_await connections.next();
+        if (!conn) {
+            std::fprintf(stderr, "Error in accept: %s\n", conn.error().message().c_str());
+            std::exit(1);
+        }
+        echo(io, std::move(conn->fd));
+    }
+}
+
+BasicCoroutine client(IoQueue& io, Fd socket, size_t numRoundTrips)
+{
+    const char msg[] = "Hello!";
+    char buffer[64];
+    for (size_t i = 0; i < numRoundTrips; ++i) {
+        const auto sentBytes = co_await io.send(socket, msg, sizeof(msg));
+        const auto receivedBytes = co_await io.recv(socket, buffer, sizeof(buffer));
+        if (!sentBytes || !receivedBytes || *receivedBytes == 0) {
+            std::fprintf(stderr, "Error in round trip\n");
+            std::exit(1);
+        }
+    }
+    co_await io.close(socket.release());
+}
+
+Fd connectTo(uint16_t port)
+{
+    Fd fd { ::socket(AF_INET, SOCK_STREAM, 0) };
+    ::sockaddr_in addr {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (fd == -1 || ::connect(fd, reinterpret_cast<::sockaddr*>(&addr), sizeof(addr)) == -1) {
+        std::perror("connect");
+        std::exit(1);
+    }
+    int one = 1;
+    ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return fd;
+}
+
+void run(const Mode& mode, size_t numConnections, size_t numRoundTrips)
+{
+    auto listenSocket = createTcpListenSocket(IpAddressPort::parse("127.0.0.1:0").value());
+    if (listenSocket == -1) {
+        std::exit(1);
+    }
+    ::sockaddr_in addr {};
+    socklen_t addrLen = sizeof(addr);
+    ::getsockname(listenSocket, reinterpret_cast<::sockaddr*>(&addr), &addrLen);
+    const auto port = ntohs(addr.sin_port);
+
+    // The IoQueue has to be created on the server thread for SINGLE_ISSUER
+    std::thread server([&] {
+        IoQueue io(mode.options);
+        serve(io, listenSocket, numConnections);
+        io.run();
+    });
+
+    IoQueue io;
+    for (size_t i = 0; i < numConnections; ++i) {
+        client(io, connectTo(port), numRoundTrips);
+    }
+    const auto start = std::chrono::steady_clock::now();
+    io.run();
+    const auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start);
+    server.join();
+
+    const auto roundTrips = static_cast<double>(numConnections * numRoundTrips);
+    std::printf("%-30s %10.0f round trips/s\n", mode.name.c_str(), roundTrips / elapsed.count());
+}
+
+int main(int argc, char** argv)
+{
+    const size_t numConnections = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 16;
+    const size_t numRoundTrips = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 20'000;
+
+    std::printf("%zu connections, %zu round trips each\n", numConnections, numRoundTrips);
+    for (const auto& mode : getModes()) {
+        run(mode, numConnections, numRoundTrips);
+    }
+}
@@ -0,0 +1,249 @@
+// Serves a corpus of small and large files with OpenFileCache and FileSender from a minimal HTTP
+// server on a thread of its own and measures requests and bytes per second of a number of TCP
+// connections over loopback, with and without caching and registered buffers.
+// Usage: bench-staticfiles [connections] [requests per connection]
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "aiopp/basiccoroutine.hpp"
+#include "aiopp/ioqueue.hpp"
+#include "aiopp/pipepool.hpp"
+#include "aiopp/registeredbufferpool.hpp"
+#include "aiopp/socket.hpp"
+#include "aiopp/staticfiles.hpp"
+
+using namespace aiopp;
+
+struct Mode {
+    std::string name;
+    size_t cacheCapacity;
+    bool registeredBuffers;
+};
+
+struct CorpusFile {
+    std::string name;
+    size_t size;
+};
+
+constexpr size_t registeredChunkSize = 16 * 1024;
+
+std::vector<CorpusFile> createCorpus(const std::string& dir)
+{
+    std::vector<CorpusFile> corpus;
+    // Mostly small files (like icons, scripts and stylesheets) and a few large ones
+    for (size_t i = 0; i < 32; ++i) {
+        corpus.push_back({ "small-" + std::to_string(i), 512 + i * 384 });
+    }
+    corpus.push_back({ "large-0", 1024 * 1024 });
+    corpus.push_back({ "large-1", 8 * 1024 * 1024 });
+
+    const std::string data(8 * 1024 * 1024, 'x');
+    for (const auto& file : corpus) {
+        const auto path = dir + "/" + file.name;
+        Fd fd { ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644) };
+        if (fd == -1 || ::write(fd, data.data(), file.size) != static_cast<ssize_t>(file.size)) {
+            std::perror("write");
+            std::exit(1);
+        }
+    }
+    return corpus;
+}
+
+void removeCorpus(const std::string& dir, const std::vector<CorpusFile>& corpus)
+{
+    for (const auto& file : corpus) {
+        ::unlink((dir + "/" + file.name).c_str());
+    }
+    ::rmdir(dir.c_str());
+}
+
+std::string getHeader(uint64_t contentLength)
+{
+    return "HTTP/1.1 200 OK\r\nContent-Length: " + std::to_string(contentLength) + "\r\n\r\n";
+}
+
+// "GET /<path> HTTP/1.1" -> "<path>"
+std::string_view getPath(std::string_view request)
+{
+    constexpr std::string_view prefix = "GET /";
+    if (!request.starts_with(prefix)) {
+        return {};
+    }
+    request.remove_prefix(prefix.size());
+    return request.substr(0, request.find(' '));
+}
+
+BasicCoroutine session(IoQueue& io, OpenFileCache& cache, FileSender& sender, Fd socket)
+{
+    char buffer[1024];
+    while (true) {
+        // The client sends a single request and waits for the response, so it arrives in one piece
+        const auto receivedBytes = co_await io.recv(socket, buffer, sizeof(buffer));
+        if (!receivedBytes || *receivedBytes == 0) {
+            break;
+        }
+
+        const auto path = getPath(std::string_view(buffer, *receivedBytes));
+        const auto file = co_await cache.get(std::string(path));
+        if (!file) {
+            std::fprintf(stderr, "Error opening '%.*s': %s\n", static_cast<int>(path.size()),
+                path.data(), file.error().message().c_str());
+            std::exit(1);
+        }
+
+        const auto sent = co_await sender.send(socket, **file, getHeader((*file)->size));
+        if (!sent) {
+            std::fprintf(stderr, "Error sending file: %s\n", sent.error().message().c_str());
+            break;
+        }
+    }
+    co_await io.close(socket.release());
+}
+
+// Returns once all connections have been accepted, which destroys the accept stream, so run()
+// returns once all connections are closed.
+BasicCoroutine serve(IoQueue& io, const Fd& listenSocket, size_t numConnections,
+    OpenFileCache& cache, FileSender& sender)
+{
+    auto connections = io.acceptMultishot(listenSocket);
+    for (size_t i = 0; i < numConnections; ++i) {
+        auto conn = co_await connections.next();
+        if (!conn) {
+            std::fprintf(stderr, "Error in accept: %s\n", conn.error().message().c_str());
+            std::exit(1);
+        }
+        session(io, cache, sender, std::move(conn->fd));
+    }
+}
+
+BasicCoroutine client(IoQueue& io, Fd socket, const std::vector<CorpusFile>& corpus, size_t first,
+    size_t numRequests, uint64_t& bytes)
+{
+    std::vector<char> buffer(256 * 1024);
+    for (size_t i = 0; i < numRequests; ++i) {
+        const auto& file = corpus[(first + i) % corpus.size()];
+        const auto request = "GET /" + file.name + " HTTP/1.1\r\n\r\n";
+        const auto sentBytes = co_await io.send(socket, request.data(), request.size());
+        if (!sentBytes || static_cast<size_t>(*sentBytes) != request.size()) {
+            std::fprintf(stderr, "Error in send\n");
+            std::exit(1);
+        }
+
+        // The header is known, so we know how much to receive
+        const auto expected = getHeader(file.size).size() + file.size;
+        size_t received = 0;
+        while (received < expected) {
+            const auto receivedBytes = co_await io.recv(socket, buffer.data(), buffer.size());
+            if (!receivedBytes || *receivedBytes == 0) {
+                std::fprintf(stderr, "Error in receive\n");
+                std::exit(1);
+            }
+            const auto data = std::string_view(buffer.data(), static_cast<size_t>(*receivedBytes));
+            if (received == 0 && !data.starts_with("HTTP/1.1 200")) {
+                std::fprintf(stderr, "Unexpected response\n");
+                std::exit(1);
+            }
+            received += static_cast<size_t>(*receivedBytes);
+        }
+        bytes += file.size;
+    }
+    co_await io.close(socket.release());
+}
+
+Fd connectTo(uint16_t port)
+{
+    Fd fd { ::socket(AF_INET, SOCK_STREAM, 0) };
+    ::sockaddr_in addr {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (fd == -1 || ::connect(fd, reinterpret_cast<::sockaddr*>(&addr), sizeof(addr)) == -1) {
+        std::perror("connect");
+        std::exit(1);
+    }
+    return fd;
+}
+
+void run(const Mode& mode, const std::string& dir, const std::vector<CorpusFile>& corpus,
+    size_t numConnections, size_t numRequests)
+{
+    auto listenSocket = createTcpListenSocket(IpAddressPort::parse("127.0.0.1:0").value());
+    if (listenSocket == -1) {
+        std::exit(1);
+    }
+    ::sockaddr_in addr {};
+    socklen_t addrLen = sizeof(addr);
+    ::getsockname(listenSocket, reinterpret_cast<::sockaddr*>(&addr), &addrLen);
+    const auto port = ntohs(addr.sin_port);
+
+    std::thread server([&] {
+        IoQueue io;
+        Fd rootDir { ::open(dir.c_str(), O_PATH | O_DIRECTORY | O_CLOEXEC) };
+        OpenFileCache cache(io, std::move(rootDir), mode.cacheCapacity);
+        PipePool pipes;
+        std::optional<RegisteredBufferPool> buffers;
+        if (mode.registeredBuffers) {
+            buffers.emplace(io, numConnections, registeredChunkSize);
+            if (!*buffers) {
+                std::exit(1);
+            }
+        }
+        FileSender sender(io, pipes, buffers ? &*buffers : nullptr);
+        serve(io, listenSocket, numConnections, cache, sender);
+        io.run();
+    });
+
+    IoQueue io;
+    uint64_t bytes = 0;
+    for (size_t i = 0; i < numConnections; ++i) {
+        client(io, connectTo(port), corpus, i, numRequests, bytes);
+    }
+    const auto start = std::chrono::steady_clock::now();
+    io.run();
+    const auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start);
+    server.join();
+
+    const auto requests = static_cast<double>(numConnections * numRequests);
+    const auto mibs = static_cast<double>(bytes) / (1024.0 * 1024.0);
+    std::printf("%-30s %10.0f requests/s %10.1f MiB/s\n", mode.name.c_str(),
+        requests / elapsed.count(), mibs / elapsed.count());
+}
+
+int main(int argc, char** argv)
+{
+    const size_t numConnections = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 16;
+    const size_t numRequests = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 2'000;
+
+    char dirTemplate[] = "/tmp/aiopp-bench-staticfiles-XXXXXX";
+    if (!::mkdtemp(dirTemplate)) {
+        std::perror("mkdtemp");
+        return 1;
+    }
+    const std::string dir = dirTemplate;
+    const auto corpus = createCorpus(dir);
+
+    const std::vector<Mode> modes {
+        { "splice, no cache", 0, false },
+        { "splice, cache", 1024, false },
+        { "fixed buffers+splice, cache", 1024, true },
+    };
+
+    std::printf("%zu connections, %zu requests each, %zu files\n", numConnections, numRequests,
+        corpus.size());
+    for (const auto& mode : modes) {
+        run(mode, dir, corpus, numConnections, numRequests);
+    }
+    removeCorpus(dir, corpus);
+}
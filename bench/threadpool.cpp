@@ -0,0 +1,113 @@
+// Compares the work-stealing ThreadPool with the single mutex/condvar queue it replaced.
+// `numSubmitters` threads push small tasks concurrently and we measure how long it takes until all
+// of them have run.
+// With the default injector capacity most of the tasks end up in the overflow queue, so we also
+// measure a ThreadPool with an injector that can hold all of them.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+#include "aiopp/function.hpp"
+#include "aiopp/threadpool.hpp"
+
+using namespace aiopp;
+
+// This is the ThreadPool this repository used before (without submit).
+class LegacyThreadPool {
+public:
+    LegacyThreadPool(size_t numThreads = std::thread::hardware_concurrency())
+    {
+        running_.store(true);
+        for (size_t i = 0; i < std::max(1ul, numThreads); ++i) {
+            threads_.push_back(std::thread(&LegacyThreadPool::workerFunc, this));
+        }
+    }
+
+    ~LegacyThreadPool()
+    {
+        running_.store(false);
+        tasksCv_.notify_all();
+        for (auto& thread : threads_) {
+            thread.join();
+        }
+    }
+
+    void push(Function<void()> task)
+    {
+        {
+            std::lock_guard lock(tasksMutex_);
+            tasks_.push(std::move(task));
+        }
+        tasksCv_.notify_one();
+    }
+
+private:
+    void workerFunc()
+    {
+        while (running_.load()) {
+            std::unique_lock lock(tasksMutex_);
+            tasksCv_.wait(lock, [this] { return !tasks_.empty() || !running_.load(); });
+            if (running_.load()) {
+                auto task = std::move(tasks_.front());
+                tasks_.pop();
+                lock.unlock();
+                task();
+            }
+        }
+    }
+
+    std::atomic<bool> running_;
+    std::vector<std::thread> threads_;
+    std::condition_variable tasksCv_;
+    std::mutex tasksMutex_;
+    std::queue<Function<void(void)>> tasks_;
+};
+
+template <typename Pool, typename... Args>
+double run(size_t numSubmitters, size_t tasksPerSubmitter, Args... poolArgs)
+{
+    Pool pool(poolArgs...);
+    std::atomic<size_t> done { 0 };
+    const auto total = numSubmitters * tasksPerSubmitter;
+
+    const auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> submitters;
+    for (size_t s = 0; s < numSubmitters; ++s) {
+        submitters.emplace_back([&pool, &done, tasksPerSubmitter]() {
+            for (size_t i = 0; i < tasksPerSubmitter; ++i) {
+                pool.push([&done]() { done.fetch_add(1, std::memory_order_relaxed); });
+            }
+        });
+    }
+    for (auto& thread : submitters) {
+        thread.join();
+    }
+    while (done.load() < total) {
+        std::this_thread::yield();
+    }
+    const auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(end - start).count() / total;
+}
+
+int main()
+{
+    constexpr size_t totalTasks = 1'000'000;
+    const auto numThreads = std::thread::hardware_concurrency();
+    std::printf("%-12s %14s %14s %14s\n", "submitters", "legacy ns/op", "stealing ns/op",
+        "no overflow");
+    for (const size_t numSubmitters : { 1, 8, 64 }) {
+        const auto perSubmitter = totalTasks / numSubmitters;
+        const auto legacy = run<LegacyThreadPool>(numSubmitters, perSubmitter);
+        const auto stealing = run<ThreadPool>(numSubmitters, perSubmitter);
+        const auto noOverflow
+            = run<ThreadPool>(numSubmitters, perSubmitter, numThreads, totalTasks);
+        std::printf("%-12zu %14.1f %14.1f %14.1f\n", numSubmitters, legacy, stealing, noOverflow);
+    }
+}
@@ -23,6 +23,16 @@ BasicCoroutine receiver(std::string id, Channel<std::string>& channel)
     }
 }
 
+BasicCoroutine batchReceiver(std::string id, Channel<std::string>& channel)
+{
+    while (true) {
+        const auto msgs = co_await channel.receiveMany(16);
+        for (const auto& msg : msgs) {
+            spdlog::info("[{}] Message ({} in batch): {}", id, msgs.size(), msg);
+        }
+    }
+}
+
 BasicCoroutine sender(IoQueue& io, Channel<std::string>& channel)
 {
     threadPool().push([&channel]() {
@@ -40,12 +50,36 @@ BasicCoroutine sender(IoQueue& io, Channel<std::string>& channel)
     }
 }
 
+BasicCoroutine boundedReceiver(IoQueue& io, BoundedChannel<int>& channel)
+{
+    while (true) {
+        // Slow receiver, so the producer has to wait
+        const auto msgs = co_await channel.receiveMany(4);
+        spdlog::info("[bounded] Received {} messages, first: {}", msgs.size(), msgs.front());
+        co_await io.timeout(std::chrono::milliseconds(500));
+    }
+}
+
+void boundedProducer(BoundedChannel<int>& channel)
+{
+    threadPool().push([&channel]() {
+        for (int i = 0;; ++i) {
+            channel.sendBlocking(i);
+        }
+    });
+}
+
 int main()
 {
     IoQueue io;
+    BoundedChannel<int> boundedChannel(io, 8);
+    boundedReceiver(io, boundedChannel);
+    boundedProducer(boundedChannel);
+
     Channel<std::string> channel(io);
     receiver("1", channel);
     receiver("2", channel);
+    batchReceiver("3", channel);
     sender(io, channel);
     io.run();
 }
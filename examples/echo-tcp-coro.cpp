@@ -31,13 +31,24 @@ Task<std::pair<std::error_code, bool>> sendAll(
 
 BasicCoroutine echo(IoQueue& io, Fd socket)
 {
+    // If the send below times out, the kernel might still read from the buffer until the canceled
+    // operation completes, so it has to live until the socket is closed.
+    std::string recvBuffer;
     while (true) {
-        std::string recvBuffer(1024, '\0');
-        const auto receivedBytes = co_await io.timeout(
-            std::chrono::milliseconds(5000), io.recv(socket, recvBuffer.data(), recvBuffer.size()));
+        recvBuffer.resize(1024);
+        // The deadline is kept in the timer wheel of the IoQueue, so it does not cost an extra SQE
+        const auto receivedBytes = co_await io.withDeadline(
+            io.recv(socket, recvBuffer.data(), recvBuffer.size()), std::chrono::milliseconds(5000));
         if (!receivedBytes && receivedBytes.error() == std::errc::operation_canceled) {
-            co_await sendAll(io, socket, "Session timed out. Bye!");
-            break;
+            // Saying goodbye, shutting down and closing is submitted at once as a linked chain.
+            // It is hard linked, so the socket is closed even if the send fails or is short.
+            static constexpr std::string_view bye = "Session timed out. Bye!";
+            auto teardown = io.chain<3>(true);
+            teardown.add(io.send(socket, bye.data(), bye.size()));
+            teardown.add(io.shutdown(socket, SHUT_WR));
+            teardown.add(io.close(socket.release()));
+            co_await teardown;
+            co_return;
         }
 
         if (!receivedBytes) {
@@ -51,7 +62,14 @@ BasicCoroutine echo(IoQueue& io, Fd socket)
 
         recvBuffer.resize(*receivedBytes);
 
-        const auto [sendEc, eof] = co_await sendAll(io, socket, recvBuffer);
+        // If the client does not read, the send can't complete, so we give up at some point
+        const auto sendRes = co_await withTimeout(
+            io, sendAll(io, socket, recvBuffer), std::chrono::milliseconds(5000));
+        if (!sendRes) {
+            spdlog::warn("Send timed out");
+            break;
+        }
+        const auto [sendEc, eof] = *sendRes;
         if (sendEc || eof) {
             break;
         }
@@ -61,13 +79,14 @@ BasicCoroutine echo(IoQueue& io, Fd socket)
 
 BasicCoroutine serve(IoQueue& io, Fd&& listenSocket)
 {
+    auto connections = io.acceptMultishot(listenSocket);
     while (true) {
-        const auto fd = co_await io.accept(listenSocket, nullptr, nullptr);
-        if (!fd) {
-            spdlog::error("Error in accept: {}", fd.error().message());
+        auto conn = co_await connections.next();
+        if (!conn) {
+            spdlog::error("Error in accept: {}", conn.error().message());
             continue;
         }
-        echo(io, Fd { *fd });
+        echo(io, std::move(conn->fd));
     }
 }
 
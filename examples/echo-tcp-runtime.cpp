@@ -0,0 +1,73 @@
+#include <csignal>
+
+#include "aiopp/ioqueue.hpp"
+#include "aiopp/runtime.hpp"
+#include "aiopp/socket.hpp"
+
+#include "aiopp/basiccoroutine.hpp"
+
+#include "spdlogger.hpp"
+
+using namespace aiopp;
+
+BasicCoroutine echo(IoQueue& io, Fd socket)
+{
+    std::string buffer(1024, '\0');
+    while (true) {
+        const auto receivedBytes = co_await io.recv(socket, buffer.data(), buffer.size());
+        if (!receivedBytes || *receivedBytes == 0) {
+            break;
+        }
+
+        size_t offset = 0;
+        while (offset < static_cast<size_t>(*receivedBytes)) {
+            const auto sentBytes
+                = co_await io.send(socket, buffer.data() + offset, *receivedBytes - offset);
+            if (!sentBytes || *sentBytes == 0) {
+                co_await io.close(socket.release());
+                co_return;
+            }
+            offset += *sentBytes;
+        }
+    }
+    co_await io.close(socket.release());
+}
+
+BasicCoroutine serve(IoQueue& io, Fd listenSocket, size_t core)
+{
+    auto connections = io.acceptMultishot(listenSocket);
+    while (true) {
+        auto conn = co_await connections.next();
+        if (!conn) {
+            spdlog::error("Error in accept on core {}: {}", core, conn.error().message());
+            continue;
+        }
+        echo(io, std::move(conn->fd));
+    }
+}
+
+Runtime* runtime = nullptr;
+
+int main()
+{
+    setLogger(std::make_unique<SpdLogger>());
+
+    Runtime rt;
+    auto sockets = rt.createListenSockets(IpAddressPort::parse("0.0.0.0:4242").value(), SOMAXCONN,
+        /*steerToCpu*/ true);
+    if (sockets.empty()) {
+        return 1;
+    }
+
+    for (size_t core = 0; core < rt.getNumCores(); ++core) {
+        rt.spawnOn(core, [core, socket = std::move(sockets[core])](IoQueue& io) mutable {
+            serve(io, std::move(socket), core);
+        });
+    }
+    spdlog::info("Listening on {} cores", rt.getNumCores());
+
+    runtime = &rt;
+    std::signal(SIGINT, [](int) { runtime->stop(); });
+    rt.join();
+    return 0;
+}
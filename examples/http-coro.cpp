@@ -1,3 +1,4 @@
+#include "aiopp/bufferring.hpp"
 #include "aiopp/ioqueue.hpp"
 #include "aiopp/socket.hpp"
 
@@ -47,18 +48,27 @@ Task<std::pair<std::error_code, bool>> sendAll(
     co_return std::make_pair(std::error_code {}, false);
 }
 
-BasicCoroutine startSession(IoQueue& io, Fd socket)
+BasicCoroutine startSession(IoQueue& io, BufferRing& buffers, Fd socket)
 {
+    auto requests = io.recvMultishot(socket, buffers);
     while (true) {
-        std::string recvBuffer(1024, '\0');
-        const auto receivedBytes = co_await io.recv(socket, recvBuffer.data(), recvBuffer.size());
-        if (!receivedBytes) {
-            spdlog::error("Error in receive: {}", receivedBytes.error().message());
-            break;
-        }
+        {
+            // We don't care about the request, so the buffer goes back to the ring at the end of
+            // this scope, before we send the response.
+            const auto received = co_await requests.next();
+            if (!received && received.error() == std::errc::no_buffer_space) {
+                // All buffers are in use. The stream is armed again, so we try again once other
+                // sessions returned theirs. The data stays in the socket until then.
+                continue;
+            }
+            if (!received) {
+                spdlog::error("Error in receive: {}", received.error().message());
+                break;
+            }
 
-        if (*receivedBytes == 0) { // Connection closed
-            break;
+            if (received->empty()) { // Connection closed
+                break;
+            }
         }
 
         const auto [sendEc, eof] = co_await sendAll(io, socket, getResponse());
@@ -69,15 +79,16 @@ BasicCoroutine startSession(IoQueue& io, Fd socket)
     co_await io.close(socket.release());
 }
 
-BasicCoroutine serve(IoQueue& io, Fd&& listenSocket)
+BasicCoroutine serve(IoQueue& io, BufferRing& buffers, Fd&& listenSocket)
 {
+    auto connections = io.acceptMultishot(listenSocket);
     while (true) {
-        const auto fd = co_await io.accept(listenSocket, nullptr, nullptr);
-        if (!fd) {
-            spdlog::error("Error in accept: {}", fd.error().message());
+        auto conn = co_await connections.next();
+        if (!conn) {
+            spdlog::error("Error in accept: {}", conn.error().message());
             continue;
         }
-        startSession(io, Fd { *fd });
+        startSession(io, buffers, std::move(conn->fd));
     }
 }
 
@@ -91,7 +102,12 @@ int main()
     }
 
     IoQueue io(1024);
-    serve(io, std::move(socket));
+    // Idle connections don't occupy a buffer, so this is plenty
+    BufferRing buffers(io, 1024, 1024);
+    if (!buffers) {
+        return 1;
+    }
+    serve(io, buffers, std::move(socket));
     io.run();
     return 0;
 }
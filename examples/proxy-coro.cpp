@@ -1,12 +1,11 @@
-#include <span>
-
 #include "spdlogger.hpp"
 
 #include "aiopp/ioqueue.hpp"
+#include "aiopp/pipepool.hpp"
+#include "aiopp/proxy.hpp"
 #include "aiopp/socket.hpp"
 #include "aiopp/task.hpp"
 #include "aiopp/util.hpp"
-#include "aiopp/wait.hpp"
 
 using namespace aiopp;
 
@@ -29,55 +28,8 @@ static const Configuration config
     },
 };
 
-Task<std::error_code> sendAll(IoQueue& io, const Fd& socket, std::span<const std::byte> buffer)
-{
-    size_t offset = 0;
-    while (offset < buffer.size()) {
-        const auto sentBytes
-            = co_await io.send(socket, buffer.data() + offset, buffer.size() - offset);
-        if (!sentBytes) {
-            spdlog::error("Error in send: {}", sentBytes.error().message());
-            co_return sentBytes.error();
-        }
-        offset += *sentBytes;
-    }
-    co_return {};
-}
-
-Task<void> echo(IoQueue& io, Fd& recvSocket, Fd& sendSocket)
-{
-    std::vector<std::byte> recvBuffer(8 * 1024);
-    while (true) {
-        const auto receivedBytes
-            = co_await io.recv(recvSocket, recvBuffer.data(), recvBuffer.size());
-        if (!receivedBytes) {
-            spdlog::error("Error in receive: {}", receivedBytes.error().message());
-            break;
-        }
-
-        if (*receivedBytes == 0) {
-            spdlog::info("Connection closed");
-            break;
-        }
-
-        const auto recvData = std::span { recvBuffer }.first(*receivedBytes);
-        const auto sendRes = co_await sendAll(io, sendSocket, recvData);
-        if (sendRes != std::error_code {}) {
-            spdlog::info("Error in send: {}", sendRes.message());
-            break;
-        }
-    }
-    // We shutdown the sockets here to wake up the other `echo`, which will then detect a connection
-    // closure as well.
-    // And we do an async closure, so the destructor of this coroutine (and
-    // clientSocket) does not hold up the event loop synchronously.
-    co_await io.shutdown(recvSocket, SHUT_RDWR);
-    co_await io.close(recvSocket.release());
-    co_await io.shutdown(sendSocket, SHUT_RDWR);
-    co_await io.close(sendSocket.release());
-}
-
-BasicCoroutine handleClient(IoQueue& io, Fd clientSocket, const IpAddressPort& upstreamAddr)
+BasicCoroutine handleClient(
+    IoQueue& io, PipePool& pipes, Fd clientSocket, const IpAddressPort& upstreamAddr)
 {
     auto upstreamSocket = createSocket(SocketType::Tcp);
     const auto sa = upstreamAddr.getSockAddr();
@@ -99,17 +51,23 @@ BasicCoroutine handleClient(IoQueue& io, Fd clientSocket, const IpAddressPort& u
 
     spdlog::info("Connected to upstream at {}", upstreamAddr.toString());
 
-    // This coroutine must outlive both `echo`s, because they reference the sockets, so we need to
-    // wait for them.
-    co_await WaitAll {
-        echo(io, clientSocket, upstreamSocket),
-        echo(io, upstreamSocket, clientSocket),
-    };
+    // The data is spliced from one socket to the other through a pipe (a hard linked pair of
+    // splices per chunk), so it is never copied to userspace.
+    const auto res = co_await proxyBidirectional(io, clientSocket, upstreamSocket, pipes);
+    if (res.error) {
+        spdlog::info("Error in proxy: {}", res.error.message());
+    }
 
-    spdlog::info("Done handling client");
+    // We do an async closure, so the destructor of this coroutine (and the sockets) does not hold
+    // up the event loop synchronously.
+    co_await io.close(clientSocket.release());
+    co_await io.close(upstreamSocket.release());
+
+    spdlog::info("Done handling client ({} bytes up, {} bytes down)", res.bytesAToB, res.bytesBToA);
 }
 
-BasicCoroutine serve(IoQueue& io, Fd listenSocket, const IpAddressPort& upstreamAddr)
+BasicCoroutine serve(
+    IoQueue& io, PipePool& pipes, Fd listenSocket, const IpAddressPort& upstreamAddr)
 {
     while (true) {
         ::sockaddr_in sa;
@@ -120,7 +78,7 @@ BasicCoroutine serve(IoQueue& io, Fd listenSocket, const IpAddressPort& upstream
             continue;
         }
         spdlog::info("Got connection from {}", IpAddressPort(sa).toString());
-        handleClient(io, Fd { *fd }, upstreamAddr);
+        handleClient(io, pipes, Fd { *fd }, upstreamAddr);
     }
 }
 
@@ -130,6 +88,9 @@ int main(int, char**)
 
     IoQueue io;
 
+    // Every connection needs two pipes (one per direction), which are reused for later connections
+    PipePool pipes;
+
     for (const auto& upstream : config.upstreams) {
         const auto listenAddr = IpAddressPort::parse(upstream.listenAddr);
         if (!listenAddr) {
@@ -150,7 +111,7 @@ int main(int, char**)
             return 1;
         }
 
-        serve(io, std::move(socket), *upstreamAddr);
+        serve(io, pipes, std::move(socket), *upstreamAddr);
     }
 
     io.run();
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include "aiopp/fd.hpp"
+#include "aiopp/ioqueue.hpp"
+#include "aiopp/result.hpp"
+#include "aiopp/task.hpp"
+
+namespace aiopp {
+// A file that is read and written through an IoQueue, so disk I/O does not block the thread (or
+// has to be moved to a ThreadPool). All reads and writes are positional, so there is no file
+// position that concurrent operations could race on.
+// Buffers must stay valid until the respective operation completed.
+class AsyncFile {
+public:
+    using OperationHandle = IoQueue::OperationHandle;
+
+    // `path` must stay valid until the task completed
+    static Task<Result<AsyncFile>> open(IoQueue& io, const char* path, int flags, mode_t mode = 0);
+    static Task<Result<AsyncFile>> openAt(
+        IoQueue& io, int dirfd, const char* path, int flags, mode_t mode = 0);
+
+    AsyncFile() = default;
+    AsyncFile(IoQueue& io, Fd fd);
+
+    explicit operator bool() const { return fd_ != -1; }
+
+    const Fd& fd() const { return fd_; }
+    Fd release();
+
+    OperationHandle read(void* buf, size_t count, uint64_t offset);
+    OperationHandle write(const void* buf, size_t count, uint64_t offset);
+    OperationHandle readv(const ::iovec* iov, int iovcnt, uint64_t offset);
+    OperationHandle writev(const ::iovec* iov, int iovcnt, uint64_t offset);
+
+    // These keep going after short reads and writes. readAll stops at the end of the file.
+    // The result is the number of bytes transferred (which might not fit in an IoResult) or the
+    // first error.
+    Task<Result<size_t>> readAll(void* buf, size_t count, uint64_t offset);
+    Task<Result<size_t>> writeAll(const void* buf, size_t count, uint64_t offset);
+
+    OperationHandle fsync();
+    OperationHandle fdatasync();
+
+    Task<Result<struct ::statx>> stat(unsigned int mask = STATX_BASIC_STATS);
+
+    // The file is closed synchronously when it is destroyed, unless it was closed with this.
+    OperationHandle close();
+
+private:
+    IoQueue* io_ = nullptr;
+    Fd fd_;
+};
+}
@@ -2,9 +2,11 @@
 
 #include <coroutine>
 
+#include "aiopp/framepool.hpp"
+
 class BasicCoroutine {
 public:
-    struct Promise {
+    struct Promise : public aiopp::PooledFrame {
         BasicCoroutine get_return_object() { return BasicCoroutine {}; }
 
         void unhandled_exception() noexcept { }
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cassert>
+#include <cstdint>
+#include <memory>
+#include <optional>
+
+namespace aiopp {
+// Vyukov bounded MPMC (multiple producers, multiple consumers) queue
+// https://www.1024cores.net/home/lock-free-algorithms/queues/bounded-mpmc-queue
+// Every cell has a sequence number, that tells producers and consumers whether it is their turn
+// to use that cell, so they only have to contend on the respective position counter.
+// Like MpscQueue this requires T to be default constructible.
+template <typename T>
+class BoundedQueue {
+public:
+    // capacity will be rounded up to the next power of two
+    BoundedQueue(size_t capacity)
+        : cells_(new Cell[std::bit_ceil(std::max(capacity, size_t(2)))])
+        , mask_(std::bit_ceil(std::max(capacity, size_t(2))) - 1)
+    {
+        for (size_t i = 0; i <= mask_; ++i) {
+            cells_[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    size_t capacity() const { return mask_ + 1; }
+
+    // This is only a hint, because it might change at any moment
+    bool empty() const
+    {
+        return consumeEnd_.load(std::memory_order_relaxed)
+            >= produceEnd_.load(std::memory_order_relaxed);
+    }
+
+    // Returns false if the queue is full. `value` is only moved from if this returns true.
+    bool tryProduce(T&& value)
+    {
+        auto pos = produceEnd_.load(std::memory_order_relaxed);
+        Cell* cell = nullptr;
+        while (true) {
+            cell = &cells_[pos & mask_];
+            const auto seq = cell->sequence.load(std::memory_order_acquire);
+            const auto diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+            if (diff == 0) {
+                // The cell is free
+                if (produceEnd_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                // The cell still contains the value from the previous lap, so the queue is full
+                return false;
+            } else {
+                // Another producer took this cell
+                pos = produceEnd_.load(std::memory_order_relaxed);
+            }
+        }
+        cell->value = std::move(value);
+        cell->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    std::optional<T> consume()
+    {
+        auto pos = consumeEnd_.load(std::memory_order_relaxed);
+        Cell* cell = nullptr;
+        while (true) {
+            cell = &cells_[pos & mask_];
+            const auto seq = cell->sequence.load(std::memory_order_acquire);
+            const auto diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+            if (diff == 0) {
+                if (consumeEnd_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                // Nothing has been produced into this cell yet, so the queue is empty
+                return std::nullopt;
+            } else {
+                pos = consumeEnd_.load(std::memory_order_relaxed);
+            }
+        }
+        auto value = std::move(cell->value);
+        // Make the cell available for the producer in the next lap
+        cell->sequence.store(pos + mask_ + 1, std::memory_order_release);
+        return value;
+    }
+
+private:
+    struct Cell {
+        std::atomic<size_t> sequence;
+        T value;
+    };
+
+    std::unique_ptr<Cell[]> cells_;
+    size_t mask_;
+    // Separate cache lines, so producers and consumers don't bother each other
+    alignas(64) std::atomic<size_t> produceEnd_ { 0 };
+    alignas(64) std::atomic<size_t> consumeEnd_ { 0 };
+};
+}
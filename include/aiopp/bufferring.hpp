@@ -0,0 +1,88 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string_view>
+
+#include "aiopp/ioqueue.hpp"
+
+struct io_uring_buf_ring;
+
+namespace aiopp {
+class BufferRing;
+
+// A buffer from a BufferRing that the kernel picked for a receive operation.
+// It is given back to the ring when this object is destroyed (or release is called).
+class ProvidedBuffer {
+public:
+    ProvidedBuffer() = default;
+    ProvidedBuffer(BufferRing* ring, uint16_t id, std::byte* data, size_t size);
+    ProvidedBuffer(ProvidedBuffer&& other);
+    ProvidedBuffer(const ProvidedBuffer&) = delete;
+    ~ProvidedBuffer();
+
+    ProvidedBuffer& operator=(ProvidedBuffer&& other);
+    ProvidedBuffer& operator=(const ProvidedBuffer&) = delete;
+
+    // A ProvidedBuffer without data is returned if the connection was closed
+    bool empty() const { return size_ == 0; }
+
+    std::byte* data() const { return data_; }
+    size_t size() const { return size_; }
+    std::span<std::byte> span() const { return { data_, size_ }; }
+    std::string_view str() const { return { reinterpret_cast<const char*>(data_), size_ }; }
+
+    void release();
+
+private:
+    BufferRing* ring_ = nullptr;
+    uint16_t id_ = 0;
+    std::byte* data_ = nullptr;
+    size_t size_ = 0;
+};
+
+// A set of equally sized buffers that is registered with the kernel as a provided buffer ring
+// (IORING_REGISTER_PBUF_RING). Receive operations that use a BufferRing (IoQueue::recv(int,
+// BufferRing&)) do not need a buffer while they are pending. Instead the kernel picks one from the
+// ring once data has arrived, so memory is only in use for data that has actually been received.
+// If the ring is empty, receive operations fail with ENOBUFS.
+// The BufferRing must outlive all ProvidedBuffers and all pending operations that use it and must
+// be destroyed before the IoQueue.
+class BufferRing final : public IoQueue::Completer {
+public:
+    // numBuffers must be a power of two and at most 32768.
+    BufferRing(IoQueue& io, size_t numBuffers, size_t bufferSize);
+    ~BufferRing();
+
+    BufferRing(const BufferRing&) = delete;
+    BufferRing& operator=(const BufferRing&) = delete;
+
+    explicit operator bool() const { return bufRing_ != nullptr; }
+
+    uint16_t getGroupId() const { return groupId_; }
+    size_t getNumBuffers() const { return numBuffers_; }
+    size_t getBufferSize() const { return bufferSize_; }
+
+    // Returns the buffer the kernel selected for an operation with the given completion flags.
+    // The ProvidedBuffer is empty, if no buffer was selected.
+    ProvidedBuffer getBuffer(uint32_t completionFlags, size_t size);
+
+    // Gives the buffer back to the kernel
+    void release(uint16_t bufferId);
+
+    // The BufferRing takes over as the completer of canceled operations that use it, so that
+    // buffers that were selected for them are not lost.
+    void complete(IoResult result, uint32_t flags) override;
+
+private:
+    std::byte* getBufferData(uint16_t bufferId) const;
+
+    IoQueue& io_;
+    size_t numBuffers_;
+    size_t bufferSize_;
+    uint16_t groupId_;
+    std::byte* memory_ = nullptr;
+    io_uring_buf_ring* bufRing_ = nullptr;
+};
+}
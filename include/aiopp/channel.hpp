@@ -1,68 +1,388 @@
 #pragma once
 
-#include <condition_variable>
-#include <mutex>
-#include <queue>
+#include <atomic>
+#include <deque>
+#include <optional>
+#include <vector>
 
+#include "aiopp/boundedqueue.hpp"
+#include "aiopp/eventfd.hpp"
 #include "aiopp/ioqueue.hpp"
 #include "aiopp/log.hpp"
+#include "aiopp/mpscqueue.hpp"
 
 namespace aiopp {
-template <typename Message>
-class Channel {
+namespace detail {
+    template <typename Message, typename Queue>
+    class ChannelReceiver;
+}
+
+// The receiving side of Channel and BoundedChannel. Queue needs a lock-free consume().
+template <typename Message, typename Queue>
+class detail::ChannelReceiver {
+    // Lives in the frame of the waiting coroutine
+    struct Waiter {
+        std::coroutine_handle<> handle = {};
+        // Exactly one of these is set
+        std::optional<Message>* single = nullptr;
+        std::vector<Message>* many = nullptr;
+        size_t maxMessages = 1;
+    };
+
 public:
-    Channel(IoQueue& io)
+    class ReceiveAwaiter;
+    class ReceiveManyAwaiter;
+
+    template <typename... Args>
+    ChannelReceiver(IoQueue& io, Args&&... queueArgs)
         : io_(io)
-        , eventFd_(EventFd::Flags::Semaphore)
+        , queue_(std::forward<Args>(queueArgs)...)
     {
     }
 
-    void send(Message msg)
+    ChannelReceiver(const ChannelReceiver&) = delete;
+    ChannelReceiver& operator=(const ChannelReceiver&) = delete;
+
+    // The receive functions must only be called from the thread running `io`.
+
+    void receive(Function<void(Message)> callback) { receiveCallback(std::move(callback)); }
+
+    ReceiveAwaiter receive() { return ReceiveAwaiter(*this); }
+
+    // Resumes as soon as at least one message is available and returns up to `maxMessages`.
+    ReceiveManyAwaiter receiveMany(size_t maxMessages)
     {
+        return ReceiveManyAwaiter(*this, maxMessages);
+    }
+
+    std::optional<Message> tryReceive()
+    {
+        // Don't take messages away from receivers that are already waiting
+        if (!waiters_.empty()) {
+            return std::nullopt;
+        }
+        return queue_.consume();
+    }
+
+    class ReceiveAwaiter {
+    public:
+        ReceiveAwaiter(ChannelReceiver& channel)
+            : channel_(channel)
+        {
+        }
+
+        bool await_ready()
+        {
+            message_ = channel_.tryReceive();
+            return message_.has_value();
+        }
+
+        void await_suspend(std::coroutine_handle<> handle)
+        {
+            waiter_.handle = handle;
+            waiter_.single = &message_;
+            channel_.wait(&waiter_);
+        }
+
+        Message await_resume() { return std::move(*message_); }
+
+    private:
+        ChannelReceiver& channel_;
+        Waiter waiter_;
+        std::optional<Message> message_;
+    };
+
+    class ReceiveManyAwaiter {
+    public:
+        ReceiveManyAwaiter(ChannelReceiver& channel, size_t maxMessages)
+            : channel_(channel)
+            , maxMessages_(maxMessages)
+        {
+            assert(maxMessages_ > 0);
+        }
+
+        bool await_ready()
+        {
+            while (messages_.size() < maxMessages_) {
+                auto msg = channel_.tryReceive();
+                if (!msg) {
+                    break;
+                }
+                messages_.push_back(std::move(*msg));
+            }
+            return !messages_.empty();
+        }
+
+        void await_suspend(std::coroutine_handle<> handle)
         {
-            std::unique_lock lock(mutex_);
-            messages_.push(std::move(msg));
+            waiter_.handle = handle;
+            waiter_.many = &messages_;
+            waiter_.maxMessages = maxMessages_;
+            channel_.wait(&waiter_);
+        }
+
+        std::vector<Message> await_resume() { return std::move(messages_); }
+
+    private:
+        ChannelReceiver& channel_;
+        size_t maxMessages_;
+        Waiter waiter_;
+        std::vector<Message> messages_;
+    };
+
+protected:
+    // Call this after a message was pushed into the queue
+    void notifyReceiver()
+    {
+        // This is a read-modify-write, so it can't be reordered before the push (see pump).
+        if (parked_.exchange(false)) {
+            eventFd_.write();
+        }
+    }
+
+    IoQueue& io_;
+    Queue queue_;
+
+private:
+    BasicCoroutine receiveCallback(Function<void(Message)> callback)
+    {
+        callback(co_await receive());
+    }
+
+    void wait(Waiter* waiter)
+    {
+        waiters_.push_back(waiter);
+        if (!pumping_) {
+            pump();
         }
-        eventFd_.write();
     }
 
-    void receive(Function<void(Message)> callback)
+    // Hands out messages to waiting receivers and returns whether there were any
+    bool deliver()
     {
-        eventFd_.read(io_, [this, callback = std::move(callback)](Result<uint64_t> res) {
+        bool delivered = false;
+        while (!waiters_.empty()) {
+            auto msg = queue_.consume();
+            if (!msg) {
+                break;
+            }
+            delivered = true;
+
+            auto waiter = waiters_.front();
+            waiters_.pop_front();
+            if (waiter->single) {
+                *waiter->single = std::move(*msg);
+            } else {
+                waiter->many->push_back(std::move(*msg));
+                while (waiter->many->size() < waiter->maxMessages) {
+                    msg = queue_.consume();
+                    if (!msg) {
+                        break;
+                    }
+                    waiter->many->push_back(std::move(*msg));
+                }
+            }
+            // This might add new waiters (at the back), but pump will not be started again.
+            waiter->handle.resume();
+        }
+        return delivered;
+    }
+
+    // Runs while there are waiting receivers. There is only ever a single eventfd read in flight.
+    BasicCoroutine pump()
+    {
+        pumping_ = true;
+        while (!waiters_.empty()) {
+            if (deliver()) {
+                continue;
+            }
+
+            // A sender that pushed a message before we parked, might not have seen parked_ set, so
+            // we have to check again. A sender that pushes afterwards will see it and write the
+            // eventfd. The exchange (instead of a store) makes sure the check is not reordered
+            // before parking.
+            parked_.exchange(true);
+            if (deliver()) {
+                parked_.store(false);
+                continue;
+            }
+
+            // If we unparked above, but a sender saw parked_ anyway, the eventfd will be written
+            // spuriously and this read will return immediately, which is fine.
+            const auto res
+                = co_await io_.read(eventFd_.fd(), &eventFdValue_, sizeof(eventFdValue_));
             if (!res) {
                 getLogger().log(LogSeverity::Fatal,
                     "Error reading from eventfd in Channel: " + res.error().message());
                 std::abort();
             }
-            auto msg = pop();
-            callback(std::move(msg));
-        });
+            parked_.store(false);
+        }
+        pumping_ = false;
     }
 
-    Task<Message> receive()
+    std::atomic<bool> parked_ { false };
+    EventFd eventFd_;
+    uint64_t eventFdValue_ = 0;
+    // Only accessed from the receiving thread
+    std::deque<Waiter*> waiters_;
+    bool pumping_ = false;
+};
+
+// Messages can be sent from any thread, but they are received on the thread running `io`.
+// Sending is lock-free and the eventfd is only written if the receiving side is parked (waiting
+// for it), so a busy receiver is not woken up for every single message and with receiveMany it
+// can drain a whole batch per wakeup.
+// Like MpscQueue, this requires Message to be default constructible.
+// This is unbounded, so if the receiver can't keep up, it will grow indefinitely. Use
+// BoundedChannel if you need backpressure.
+template <typename Message>
+class Channel : public detail::ChannelReceiver<Message, MpscQueue<Message>> {
+public:
+    Channel(IoQueue& io)
+        : detail::ChannelReceiver<Message, MpscQueue<Message>>(io)
     {
-        const auto res = co_await eventFd_.read(io_);
-        if (!res) {
-            getLogger().log(LogSeverity::Fatal,
-                "Error reading from eventfd in Channel: " + res.error().message());
-            std::abort();
+    }
+
+    void send(Message msg)
+    {
+        this->queue_.produce(std::move(msg));
+        this->notifyReceiver();
+    }
+};
+
+namespace detail {
+    template <typename Message>
+    struct BoundedChannelQueue {
+        BoundedQueue<Message> queue;
+        std::atomic<size_t> numWaitingSenders { 0 };
+        // Each write lets one waiting sender try again
+        EventFd spaceEventFd { EventFd::Flags::Semaphore };
+
+        BoundedChannelQueue(size_t capacity)
+            : queue(capacity)
+        {
+        }
+
+        std::optional<Message> consume()
+        {
+            auto msg = queue.consume();
+            if (!msg) {
+                return msg;
+            }
+            // The fence makes sure that a sender sees the free cell or we see the sender waiting.
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (numWaitingSenders.load() > 0) {
+                spaceEventFd.write();
+            }
+            return msg;
         }
-        co_return pop();
+    };
+}
+
+// Like Channel, but it can only hold `capacity` (rounded up to the next power of two) messages.
+// If it is full, senders have to wait until the receiver made space, which keeps memory bounded
+// and slows down producers that are faster than the receiver.
+template <typename Message>
+class BoundedChannel
+    : public detail::ChannelReceiver<Message, detail::BoundedChannelQueue<Message>> {
+public:
+    class SendAwaiter;
+
+    BoundedChannel(IoQueue& io, size_t capacity)
+        : detail::ChannelReceiver<Message, detail::BoundedChannelQueue<Message>>(io, capacity)
+    {
     }
 
-private:
-    Message pop()
+    size_t capacity() const { return this->queue_.queue.capacity(); }
+
+    // Returns false if the channel is full. `msg` is only moved from if this returns true.
+    bool trySend(Message& msg)
     {
-        std::unique_lock lock(mutex_);
-        assert(!messages_.empty());
-        auto msg = std::move(messages_.front());
-        messages_.pop();
-        return msg;
+        if (!this->queue_.queue.tryProduce(std::move(msg))) {
+            return false;
+        }
+        this->notifyReceiver();
+        return true;
     }
 
-    IoQueue& io_;
-    std::mutex mutex_;
-    std::queue<Message> messages_;
-    EventFd eventFd_;
+    // Blocks the calling thread while the channel is full. Don't use this on a thread running an
+    // IoQueue, because it might block the receiver.
+    void sendBlocking(Message msg)
+    {
+        while (!trySend(msg)) {
+            auto& q = this->queue_;
+            q.numWaitingSenders.fetch_add(1);
+            // The receiver might have made space before it saw us waiting
+            if (trySend(msg)) {
+                q.numWaitingSenders.fetch_sub(1);
+                return;
+            }
+            uint64_t value = 0;
+            [[maybe_unused]] const auto res = ::eventfd_read(q.spaceEventFd.fd(), &value);
+            assert(res == 0);
+            q.numWaitingSenders.fetch_sub(1);
+        }
+    }
+
+    // co_await this in a coroutine running on `io`, which may be a different IoQueue than the
+    // receiving one. It suspends while the channel is full.
+    [[nodiscard]] SendAwaiter send(IoQueue& io, Message msg)
+    {
+        return SendAwaiter(*this, io, std::move(msg));
+    }
+
+    // For senders running on the receiving IoQueue
+    [[nodiscard]] SendAwaiter send(Message msg) { return send(this->io_, std::move(msg)); }
+
+    class SendAwaiter {
+    public:
+        SendAwaiter(BoundedChannel& channel, IoQueue& io, Message msg)
+            : channel_(channel)
+            , io_(io)
+            , msg_(std::move(msg))
+        {
+        }
+
+        bool await_ready() { return channel_.trySend(msg_); }
+
+        // Only the slow path allocates a coroutine frame
+        void await_suspend(std::coroutine_handle<> handle) { channel_.waitAndSend(*this, handle); }
+
+        void await_resume() const noexcept { }
+
+    private:
+        friend class BoundedChannel;
+
+        BoundedChannel& channel_;
+        IoQueue& io_;
+        Message msg_;
+        uint64_t eventFdValue_ = 0;
+    };
+
+private:
+    BasicCoroutine waitAndSend(SendAwaiter& awaiter, std::coroutine_handle<> caller)
+    {
+        auto& q = this->queue_;
+        while (true) {
+            q.numWaitingSenders.fetch_add(1);
+            if (trySend(awaiter.msg_)) {
+                q.numWaitingSenders.fetch_sub(1);
+                break;
+            }
+            const auto res = co_await awaiter.io_.read(
+                q.spaceEventFd.fd(), &awaiter.eventFdValue_, sizeof(awaiter.eventFdValue_));
+            q.numWaitingSenders.fetch_sub(1);
+            if (!res) {
+                getLogger().log(LogSeverity::Fatal,
+                    "Error reading from eventfd in BoundedChannel: " + res.error().message());
+                std::abort();
+            }
+            if (trySend(awaiter.msg_)) {
+                break;
+            }
+        }
+        caller.resume();
+    }
 };
 }
@@ -1,21 +1,26 @@
 #pragma once
 
-#include <array>
 #include <cassert>
 #include <cstdint>
 #include <limits>
-#include <optional>
 #include <vector>
 
 using std::size_t;
 
 /* This is a custom map, because the access patterns are very specific:
- * - Values are inserted with incrementing keys
- * - We roughly know the upper bounds of elements, so we don't need rehashing
- * - A lookup should never miss. We will always hit
+ * - A key is created when an SQE is prepared and the value (completer) is set shortly after
+ * - A lookup should never miss, except for operations whose completer was removed already (e.g.
+ *   when it was canceled). These stale keys have to be detected.
  * - It's almost always insert and then get/remove (same time) (rarely another get inbetween)
  * - Values are void*
  *
+ * Because we get to choose the keys, we don't need to hash at all. The lower 32 bits of a key are
+ * an index into a slot array and the upper 32 bits are the generation of that slot, which is
+ * incremented every time the slot is freed, so that stale keys don't match anymore.
+ * The generation wraps at 31 bits, so the highest bit of a key is never set. IoQueue uses that bit
+ * to tag messages from other rings (see IoQueue::post).
+ * Free slots form an intrusive free list, so that every operation is O(1).
+ *
  * Since it's so specific, there is no point in making this generic.
  */
 
@@ -24,29 +29,35 @@ class CompleterMap {
 public:
     CompleterMap(size_t numEntries);
 
-    // If the key already exists, you mess up the map, so don't do that.
-    void insert(uint64_t key, void* value);
+    // Returns the key for the new entry. If the map is full, it will grow.
+    uint64_t insert(void* value = nullptr);
+    // Returns false if the key is not in the map (anymore).
+    bool set(uint64_t key, void* value);
     void* get(uint64_t key) const;
     void* remove(uint64_t key);
 
     size_t size() const { return size_; }
-    size_t capacity() const { return entries_.size(); }
-    float loadFactor() const { return static_cast<float>(size_) / entries_.size(); }
+    size_t capacity() const { return slots_.size(); }
+    float loadFactor() const { return static_cast<float>(size_) / slots_.size(); }
 
 private:
-    static void* Empty;
-    static void* Tombstone;
+    static constexpr uint32_t InvalidIndex = std::numeric_limits<uint32_t>::max();
+    static constexpr uint32_t GenerationMask = 0x7fff'ffff;
 
-    struct Entry {
-        uint64_t key = std::numeric_limits<uint64_t>::max();
+    struct Slot {
         void* value = nullptr;
+        uint32_t generation = 0;
+        uint32_t nextFree = InvalidIndex;
     };
 
     static size_t getNextSize(size_t num);
 
-    std::optional<size_t> lookup(uint64_t key) const;
+    const Slot* lookup(uint64_t key) const;
+    Slot* lookup(uint64_t key);
+    void grow(size_t newSize);
 
-    std::vector<Entry> entries_;
+    std::vector<Slot> slots_;
+    uint32_t freeListHead_ = InvalidIndex;
     size_t size_ = 0;
 };
 }
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <memory>
+#include <system_error>
+#include <vector>
+
+#include "aiopp/fd.hpp"
+#include "aiopp/function.hpp"
+#include "aiopp/ioqueue.hpp"
+
+namespace aiopp {
+// Accepts connections on one IoQueue (the acceptor) and hands them to other IoQueues (the workers),
+// which usually run on other threads (e.g. the cores of a Runtime).
+// The connections are moved with IORING_OP_MSG_RING, so there are no locks or extra syscalls.
+// With direct descriptors the acceptor and all workers need a registered file table
+// (IoQueue::registerFileTable) and the socket is moved with IORING_MSG_SEND_FD.
+class ConnectionDistributor {
+public:
+    // Returns the index of the worker that should get the next connection
+    using Policy = Function<size_t(const std::vector<IoQueue*>& workers)>;
+
+    static Policy roundRobin();
+    // Picks the worker with the fewest operations in flight (IoQueue::getNumOperationsInFlight)
+    static Policy leastInFlight();
+
+    // `handler` is called on the thread of the worker and takes ownership of the connection.
+    // It is a direct descriptor (for that worker) if `fd.direct` is true, so wrap it in a Fd or a
+    // DirectFd. It is called from multiple threads, so it must not modify shared state unguarded.
+    using Handler = Function<void(IoQueue& io, AnyFd fd)>;
+
+    ConnectionDistributor(IoQueue& acceptor, std::vector<IoQueue*> workers, Handler handler,
+        bool useDirectDescriptors = false, Policy policy = roundRobin());
+
+    ConnectionDistributor(const ConnectionDistributor&) = delete;
+    ConnectionDistributor& operator=(const ConnectionDistributor&) = delete;
+
+    // Starts accepting connections on the acceptor. This must be called on the acceptor thread.
+    void start(AnyFd listenSocket);
+
+    // Stops accepting connections. This must be called on the acceptor thread.
+    // The accept loop ends once the cancelation has completed, so the distributor must outlive it.
+    // Connections that are already on their way to a worker are still delivered, so the
+    // distributor must outlive those too.
+    void stop();
+
+private:
+    // Lives as long as the distributor and receives the direct descriptors on the worker thread
+    struct WorkerInbox final : public IoQueue::Completer {
+        ConnectionDistributor* distributor;
+        IoQueue* io;
+
+        void complete(IoResult result, uint32_t flags) override;
+    };
+
+    // Carries a regular fd to a worker. If the message can not be delivered, it is completed on
+    // the acceptor thread instead and closes the fd. It deletes itself.
+    struct Handoff final : public IoQueue::Completer {
+        ConnectionDistributor* distributor;
+        IoQueue* io;
+        int fd;
+
+        void complete(IoResult result, uint32_t flags) override;
+    };
+
+    // Closes the slot of a direct descriptor on the acceptor, once it has been installed on the
+    // worker (or that failed). It deletes itself.
+    struct DirectHandoff final : public IoQueue::Completer {
+        IoQueue* acceptor;
+        int index;
+
+        void complete(IoResult result, uint32_t flags) override;
+    };
+
+    BasicCoroutine acceptLoop(AnyFd listenSocket);
+    BasicCoroutine acceptDirectLoop(AnyFd listenSocket);
+    void handOff(int fd);
+    void handOffDirect(int index);
+    // Returns false if the accept loop should end
+    bool handleAcceptError(const std::error_code& ec);
+
+    IoQueue& acceptor_;
+    std::vector<IoQueue*> workers_;
+    std::vector<std::unique_ptr<WorkerInbox>> inboxes_;
+    Handler handler_;
+    bool useDirectDescriptors_;
+    Policy policy_;
+    // The accept stream of the running accept loop, if any
+    IoQueue::MultishotStream* accept_ = nullptr;
+    bool stopRequested_ = false;
+};
+}
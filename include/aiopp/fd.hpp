@@ -1,6 +1,8 @@
 #pragma once
 
 namespace aiopp {
+class IoQueue;
+
 class Fd {
 public:
     Fd();
@@ -22,11 +24,72 @@ private:
     int fd_ = -1;
 };
 
+struct AnyFd;
+
+// A direct descriptor is an index into the registered file table of an IoQueue (see
+// IoQueue::registerFileTable). The kernel does not have to look up (and reference count) the file
+// for every operation on it, which saves a bit of work per operation.
+// It is only valid for operations on that IoQueue and has to be closed through it, which this
+// class does (asynchronously) when it is destroyed.
+class DirectFd {
+public:
+    DirectFd();
+    DirectFd(IoQueue& io, int index);
+    DirectFd(DirectFd&& other);
+    DirectFd(const DirectFd& other) = delete;
+    ~DirectFd();
+
+    DirectFd& operator=(const DirectFd& other) = delete;
+    DirectFd& operator=(DirectFd&& other);
+
+    explicit operator bool() const { return index_ != -1; }
+
+    int index() const { return index_; }
+
+    void close();
+    AnyFd release(); // return the direct descriptor without closing
+
+private:
+    IoQueue* io_ = nullptr;
+    int index_ = -1;
+};
+
+// Either a regular file descriptor or a direct descriptor. IoQueue operations take this, so they
+// can be used with both.
+struct AnyFd {
+    int fd;
+    bool direct = false;
+
+    AnyFd(int fd)
+        : fd(fd)
+    {
+    }
+
+    AnyFd(const Fd& fd)
+        : fd(fd)
+    {
+    }
+
+    AnyFd(const DirectFd& fd)
+        : fd(fd.index())
+        , direct(true)
+    {
+    }
+
+    static AnyFd fromIndex(int index)
+    {
+        AnyFd fd(index);
+        fd.direct = true;
+        return fd;
+    }
+};
+
 struct Pipe {
     Fd read;
     Fd write;
 
     Pipe();
+    Pipe(Fd read, Fd write);
 
     void close();
 };
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstddef>
+
+namespace aiopp {
+// Coroutine frames of Task and BasicCoroutine are allocated from a per-thread recycler, because
+// short-lived helper coroutines (e.g. timeout, recvfrom, sendAll) are created and destroyed all the
+// time and a frame of the same size will very likely be needed again soon.
+// Frames are grouped into size classes and freed frames are kept in a free list per size class (up
+// to a limit). Large frames are simply allocated with operator new.
+// A frame freed on another thread than the one it was allocated on (e.g. after switchTo) goes into
+// the free list of the freeing thread.
+struct FramePoolStats {
+    size_t hits = 0; // allocations served from a free list
+    size_t misses = 0; // allocations that had to use operator new
+    size_t bytesHeld = 0; // in free lists
+
+    double hitRate() const
+    {
+        const auto total = hits + misses;
+        return total > 0 ? static_cast<double>(hits) / total : 0.0;
+    }
+};
+
+void* allocateFrame(size_t size);
+void deallocateFrame(void* ptr, size_t size);
+
+// For the calling thread
+FramePoolStats getFramePoolStats();
+
+// Frees all frames held by the calling thread
+void trimFramePool();
+
+// Derive your promise type from this to use the recycler for its frames.
+struct PooledFrame {
+    static void* operator new(size_t size) { return allocateFrame(size); }
+    static void operator delete(void* ptr, size_t size) { deallocateFrame(ptr, size); }
+};
+}
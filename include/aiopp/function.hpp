@@ -49,6 +49,18 @@ public:
 
     explicit operator bool() const { return callable_ != nullptr; }
 
+    // These are for containers that can only store pointers (e.g. WorkStealingDeque).
+    // release gives up ownership of the callable and returns an opaque pointer to it, which can be
+    // turned into a Function again with fromRaw.
+    void* release() { return callable_.release(); }
+
+    static Function fromRaw(void* ptr)
+    {
+        Function func;
+        func.callable_.reset(static_cast<CallableBase*>(ptr));
+        return func;
+    }
+
     Ret operator()(Args... args) const
     {
         return callable_->operator()(std::forward<Args>(args)...);
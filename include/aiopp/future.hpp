@@ -1,19 +1,90 @@
 #pragma once
 
+#include <atomic>
 #include <cassert>
 #include <condition_variable>
+#include <coroutine>
 #include <memory>
 #include <mutex>
 #include <optional>
+#include <utility>
 
 #include <aiopp/eventfd.hpp>
 
 namespace aiopp {
 namespace detail {
+    // Lives in the shared state of the future a coroutine is waiting for. While it is registered,
+    // it keeps the shared state alive through `owner`, so it stays valid if the waiting coroutine
+    // is destroyed after the entry has been pushed to the inbox already.
+    struct InboxEntry {
+        InboxEntry* next = nullptr;
+        std::coroutine_handle<> handle = {};
+        std::shared_ptr<void> owner;
+        // Set if the waiting coroutine is gone. Such entries are dropped instead of resumed.
+        bool cancelled = false;
+    };
+
+    // Every IoQueue has one of these. Threads that complete promises push the entries of the
+    // coroutines waiting for them and the IoQueue takes them all at once and resumes them.
+    // The eventfd is only written when the inbox goes from empty to non-empty, so a batch of
+    // completions costs a single write and a single read.
+    class CompletionInbox {
+    public:
+        // Thread-safe
+        void push(InboxEntry* entry)
+        {
+            auto head = head_.load(std::memory_order_relaxed);
+            do {
+                entry->next = head;
+            } while (!head_.compare_exchange_weak(
+                head, entry, std::memory_order_release, std::memory_order_relaxed));
+            if (!head) {
+                eventFd_.write();
+            }
+        }
+
+        // Only for the IoQueue. Returns the entries in the order they were pushed.
+        InboxEntry* takeAll()
+        {
+            auto entry = head_.exchange(nullptr, std::memory_order_acquire);
+            InboxEntry* reversed = nullptr;
+            while (entry) {
+                auto next = entry->next;
+                entry->next = reversed;
+                reversed = entry;
+                entry = next;
+            }
+            return reversed;
+        }
+
+        const EventFd& getEventFd() const { return eventFd_; }
+
+    private:
+        std::atomic<InboxEntry*> head_ { nullptr };
+        EventFd eventFd_;
+    };
+
     struct SharedBase {
         std::mutex mutex;
         std::condition_variable cv;
-        EventFd eventFd;
+        // Set if a coroutine is waiting for the value on an IoQueue
+        CompletionInbox* inbox = nullptr;
+        InboxEntry* waiter = nullptr;
+        InboxEntry entry;
+
+        // The mutex has to be locked already. Returns the waiter to notify, if there is one.
+        std::pair<CompletionInbox*, InboxEntry*> takeWaiter()
+        {
+            return { std::exchange(inbox, nullptr), std::exchange(waiter, nullptr) };
+        }
+
+        void notify(std::pair<CompletionInbox*, InboxEntry*> waiter)
+        {
+            cv.notify_all();
+            if (waiter.second) {
+                waiter.first->push(waiter.second);
+            }
+        }
     };
 
     template <typename T = void>
@@ -37,7 +108,7 @@ public:
 
     ~Future() = default;
 
-    // These are deleted mostly because we can only read from the eventfd once
+    // The value can only be retrieved once
     Future(const Future&) = delete;
     Future& operator=(Future&) = delete;
 
@@ -47,11 +118,7 @@ public:
     bool ready() const
     {
         std::unique_lock lock(shared_->mutex);
-        if constexpr (std::is_void_v<T>) {
-            return shared_->ready;
-        } else {
-            return shared_->value.has_value();
-        }
+        return isSet();
     }
 
     template <typename U = T>
@@ -69,19 +136,49 @@ public:
         return std::move(shared_->value.value());
     }
 
-    // Read buf for eventfd has to be associated with the operation, not with the future, because in
-    // principle I could read from eventfd twice. That means that buffer belongs to operation.
-
-    /*Task<T> wait(IoQueue& io)
+    // This is used by IoQueue::wait. Returns false if the value is set already, otherwise `handle`
+    // will be pushed to `inbox` once it is.
+    bool setInboxWaiter(detail::CompletionInbox* inbox, std::coroutine_handle<> handle)
     {
-        const auto res = co_await io.wait(shared_->eventFd);
-        assert(res);
-        co_return get();
-    }*/
+        std::unique_lock lock(shared_->mutex);
+        if (isSet()) {
+            return false;
+        }
+        assert(!shared_->waiter);
+        shared_->entry.handle = handle;
+        shared_->entry.owner = shared_;
+        shared_->entry.cancelled = false;
+        shared_->inbox = inbox;
+        shared_->waiter = &shared_->entry;
+        return true;
+    }
 
-    const EventFd& getEventFd() const { return shared_->eventFd; }
+    // This is used by IoQueue::wait if the waiting coroutine is destroyed. Returns true if the
+    // waiter was removed before it was pushed to the inbox. Otherwise it has been pushed already
+    // (or is about to be) and is marked as cancelled, so the inbox drops it.
+    bool removeInboxWaiter()
+    {
+        std::unique_lock lock(shared_->mutex);
+        if (shared_->waiter) {
+            shared_->takeWaiter();
+            shared_->entry.owner.reset();
+            return true;
+        }
+        shared_->entry.cancelled = true;
+        return false;
+    }
 
 private:
+    // The mutex has to be locked already
+    bool isSet() const
+    {
+        if constexpr (std::is_void_v<T>) {
+            return shared_->ready;
+        } else {
+            return shared_->value.has_value();
+        }
+    }
+
     std::shared_ptr<detail::SharedState<T>> shared_;
 };
 
@@ -107,24 +204,27 @@ public:
     template <typename U = T>
     requires(std::is_void_v<U>) void set()
     {
+        std::pair<detail::CompletionInbox*, detail::InboxEntry*> waiter;
         {
             std::unique_lock lock(shared_->mutex);
             assert(!shared_->ready);
             shared_->ready = true;
+            waiter = shared_->takeWaiter();
         }
-        shared_->cv.notify_all();
+        shared_->notify(waiter);
     }
 
     template <typename U = T>
     requires(!std::is_void_v<U>) void set(T value)
     {
+        std::pair<detail::CompletionInbox*, detail::InboxEntry*> waiter;
         {
             std::unique_lock lock(shared_->mutex);
             assert(!shared_->value.has_value());
             shared_->value = std::move(value);
+            waiter = shared_->takeWaiter();
         }
-        shared_->cv.notify_all();
-        shared_->eventFd.write();
+        shared_->notify(waiter);
     }
 
 private:
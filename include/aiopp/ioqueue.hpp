@@ -1,23 +1,34 @@
 #pragma once
 
+#include <array>
 #include <cassert>
 #include <chrono>
 #include <coroutine>
+#include <deque>
 #include <future>
 #include <limits>
 #include <memory>
+#include <optional>
 #include <system_error>
 #include <thread>
+#include <type_traits>
+#include <utility>
 
 #include <netinet/in.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
 
 #include "aiopp/basiccoroutine.hpp"
+#include "aiopp/fd.hpp"
 #include "aiopp/function.hpp"
 #include "aiopp/future.hpp"
 #include "aiopp/log.hpp"
 #include "aiopp/result.hpp"
 #include "aiopp/socket.hpp"
 #include "aiopp/task.hpp"
+#include "aiopp/timerwheel.hpp"
+
+struct open_how;
 
 namespace aiopp {
 struct IoResult {
@@ -46,6 +57,9 @@ private:
 };
 
 struct IoQueueImpl;
+class BufferRing;
+class ProvidedBuffer;
+class RegisteredBuffer;
 
 class IoQueue {
 public:
@@ -57,28 +71,17 @@ public:
     using Duration = std::chrono::milliseconds;
     using TimePoint = std::chrono::time_point<std::chrono::steady_clock>;
 
-    struct OperationAwaiter;
-
-    struct CoroutineCompleter {
-        OperationAwaiter* awaiter;
-
-        CoroutineCompleter(OperationAwaiter* awaiter)
-            : awaiter(awaiter)
-        {
-        }
+    // Completers get notified about the completion of an operation. `flags` are the flags of the
+    // completion queue entry.
+    // Multishot operations complete multiple times and their completer stays registered for as long
+    // as IORING_CQE_F_MORE is set in `flags`.
+    struct Completer {
+        virtual void complete(IoResult result, uint32_t flags) = 0;
 
-        void complete(IoResult result)
-        {
-            awaiter->result = result;
-            // Now the operation has completed, we don't want to cancel it anymore.
-            awaiter->operation = {};
-            awaiter->caller.resume();
-        }
+    protected:
+        ~Completer() = default;
     };
 
-    // If I ever need it, turn this into an abstract base class
-    using Completer = CoroutineCompleter;
-
     struct OperationHandle {
         IoQueue* io = nullptr;
         OperationId id = OpIdInvalid;
@@ -86,10 +89,7 @@ public:
         bool valid() const { return io && id != OpIdInvalid; }
         explicit operator bool() const { return valid(); }
 
-        void setCompleter(std::unique_ptr<Completer> completer) const
-        {
-            io->setCompleter(*this, std::move(completer));
-        }
+        void setCompleter(Completer* completer) const { io->setCompleter(*this, completer); }
 
         void cancel(bool cancelHandler) const { io->cancel(*this, cancelHandler); }
 
@@ -106,10 +106,13 @@ public:
         }
     };
 
-    struct OperationAwaiter {
+    // The awaiter lives in the frame of the awaiting coroutine anyways, so it can complete the
+    // operation itself and nothing has to be allocated per operation.
+    struct OperationAwaiter : public Completer {
         OperationHandle operation;
         std::coroutine_handle<> caller = {};
         IoResult result = {};
+        uint32_t flags = 0;
 
         ~OperationAwaiter()
         {
@@ -124,62 +127,592 @@ public:
         {
             assert(operation);
             caller = handle;
-            operation.setCompleter(std::make_unique<CoroutineCompleter>(this));
+            operation.setCompleter(this);
         }
 
         IoResult await_resume() const noexcept { return result; }
+
+        OperationAwaiter(OperationHandle operation)
+            : operation(operation)
+        {
+        }
+
+        void complete(IoResult res, uint32_t cqeFlags) override
+        {
+            result = res;
+            flags = cqeFlags;
+            // Now the operation has completed, we don't want to cancel it anymore.
+            operation = {};
+            caller.resume();
+        }
     };
 
-    IoQueue(size_t size = 1024);
+    // Awaiting this returns a Result<ProvidedBuffer>. You need to include bufferring.hpp for it.
+    struct ProvidedBufferAwaiter final : public OperationAwaiter {
+        BufferRing* buffers;
 
-    ~IoQueue(); // We only need this to destruct incomplete IoQueueImpl
+        ProvidedBufferAwaiter(OperationHandle operation, BufferRing* buffers)
+            : OperationAwaiter(operation)
+            , buffers(buffers)
+        {
+        }
 
-    size_t getSize() const;
+        ~ProvidedBufferAwaiter();
 
-    size_t getCapacity() const;
+        Result<ProvidedBuffer> await_resume() noexcept;
+    };
+
+    // This is the base class for operations that are submitted once, but complete many times.
+    // Completions are queued until they are consumed by awaiting the stream, so none are lost if
+    // the kernel produces them faster than they are consumed.
+    // If the kernel terminates the operation (clearing IORING_CQE_F_MORE), it will be submitted
+    // again when the stream is awaited after all queued completions have been consumed.
+    // Derived classes may set finished_ once no more completions can be expected (e.g. EOF), after
+    // which the stream is not armed again and awaiting it returns a result of 0 immediately.
+    // The stream registers itself as the completer, so it must not be moved.
+    class MultishotStream : public Completer {
+    public:
+        MultishotStream(const MultishotStream&) = delete;
+        MultishotStream& operator=(const MultishotStream&) = delete;
+
+        // Cancels the operation, if it is armed. Once the completions queued before have been
+        // consumed, awaiting the stream returns ECANCELED (and arms it again after that).
+        void cancel();
+
+    protected:
+        struct Completion {
+            IoResult result;
+            uint32_t flags;
+        };
+
+        template <typename Stream>
+        struct Awaiter {
+            Stream* stream;
+
+            bool await_ready() noexcept { return stream->ready(); }
+
+            void await_suspend(std::coroutine_handle<> handle) noexcept
+            {
+                stream->waiter_ = handle;
+            }
+
+            auto await_resume() { return stream->convert(stream->pop()); }
+        };
+
+        MultishotStream(IoQueue& io);
+        ~MultishotStream();
+
+        // Submit the operation. It is armed lazily, so the derived class is fully constructed.
+        virtual OperationHandle arm() = 0;
+
+        bool ready();
+        Completion pop();
+        void complete(IoResult result, uint32_t flags) override;
+
+        IoQueue& io_;
+        OperationHandle operation_;
+        std::deque<Completion> completions_;
+        std::coroutine_handle<> waiter_ = {};
+        bool finished_ = false;
+    };
+
+    class AcceptStream final : public MultishotStream {
+    public:
+        struct Connection {
+            Fd fd;
+            IpAddressPort peer;
+        };
 
-    OperationHandle accept(int fd, ::sockaddr_in* addr, socklen_t* addrlen);
+        AcceptStream(IoQueue& io, AnyFd listenFd);
+        ~AcceptStream();
 
-    OperationHandle connect(int sockfd, const ::sockaddr* addr, socklen_t addrlen);
-    OperationHandle connect(int sockfd, const ::sockaddr_in* addr);
-    Task<IoResult> connect(int sockfd, IpAddressPort addr);
+        // Awaiting the result of this returns a Result<Connection>
+        Awaiter<AcceptStream> next() { return { this }; }
 
-    OperationHandle send(int sockfd, const void* buf, size_t len);
+    private:
+        friend struct Awaiter<AcceptStream>;
 
-    OperationHandle recv(int sockfd, void* buf, size_t len);
+        OperationHandle arm() override;
+        Result<Connection> convert(Completion completion);
 
-    OperationHandle read(int fd, void* buf, size_t count);
+        AnyFd listenFd_;
+    };
+
+    class DirectAcceptStream final : public MultishotStream {
+    public:
+        DirectAcceptStream(IoQueue& io, AnyFd listenFd);
+        ~DirectAcceptStream();
+
+        // Awaiting the result of this returns a Result<DirectFd>
+        Awaiter<DirectAcceptStream> next() { return { this }; }
 
-    OperationHandle close(int fd);
+    private:
+        friend struct Awaiter<DirectAcceptStream>;
+
+        OperationHandle arm() override;
+        Result<DirectFd> convert(Completion completion);
+
+        AnyFd listenFd_;
+    };
 
-    OperationHandle shutdown(int fd, int how);
+    class RecvStream final : public MultishotStream {
+    public:
+        RecvStream(IoQueue& io, AnyFd fd, BufferRing& buffers);
+        ~RecvStream();
 
-    OperationHandle poll(int fd, short events);
+        // Awaiting the result of this returns a Result<ProvidedBuffer>, which is empty once the
+        // connection is closed. You need to include bufferring.hpp for it.
+        Awaiter<RecvStream> next() { return { this }; }
 
-    OperationHandle recvmsg(int sockfd, ::msghdr* msg, int flags);
+    private:
+        friend struct Awaiter<RecvStream>;
+
+        OperationHandle arm() override;
+        Result<ProvidedBuffer> convert(Completion completion);
+
+        AnyFd fd_;
+        BufferRing* buffers_;
+    };
+
+    // A zero-copy send completes twice: first with the number of bytes sent and then with a
+    // notification once the kernel does not need the buffer anymore.
+    // Awaiting it the first time returns the result of the send. Awaiting it a second time
+    // resumes once the buffer may be reused (or modified) and returns the notification result.
+    // The buffer must stay valid until then.
+    class ZeroCopySend final : public Completer {
+    public:
+        ZeroCopySend(OperationHandle operation);
+        ~ZeroCopySend();
+
+        ZeroCopySend(const ZeroCopySend&) = delete;
+        ZeroCopySend& operator=(const ZeroCopySend&) = delete;
+
+        bool released() const { return notification_.has_value(); }
+
+        bool await_ready() const noexcept;
+        void await_suspend(std::coroutine_handle<> handle) noexcept;
+        IoResult await_resume() noexcept;
+
+        void complete(IoResult result, uint32_t flags) override;
+
+    private:
+        OperationHandle operation_;
+        std::coroutine_handle<> waiter_ = {};
+        std::optional<IoResult> result_;
+        std::optional<IoResult> notification_;
+        bool resultConsumed_ = false;
+    };
 
-    OperationHandle sendmsg(int sockfd, const ::msghdr* msg, int flags);
+    // See switchTo
+    class SwitchAwaiter final : public Completer {
+    public:
+        SwitchAwaiter(IoQueue& io, IoQueue& target);
+
+        bool await_ready() const noexcept { return &io_ == &target_; }
+        bool await_suspend(std::coroutine_handle<> handle) noexcept;
+        // Returns true if the coroutine is running on the target IoQueue now
+        bool await_resume() const noexcept { return &io_ == &target_ || result_; }
+
+        void complete(IoResult result, uint32_t flags) override;
+
+    private:
+        IoQueue& io_;
+        IoQueue& target_;
+        std::coroutine_handle<> caller_ = {};
+        IoResult result_ = {};
+    };
+
+    // See batch()
+    class Batch {
+    public:
+        Batch(IoQueue& io);
+        ~Batch();
+
+        Batch(const Batch&) = delete;
+        Batch& operator=(const Batch&) = delete;
+
+    private:
+        IoQueue& io_;
+    };
+
+    // See chain()
+    template <size_t N>
+    class Chain {
+    public:
+        Chain(IoQueue& io, bool hardLink)
+            : io_(io)
+            , hardLink_(hardLink)
+        {
+            io_.reserveSqes(N);
+        }
+
+        ~Chain()
+        {
+            endEarly();
+            for (auto& step : steps_) {
+                if (step.operation) {
+                    step.operation.cancel(true);
+                }
+            }
+        }
+
+        Chain(const Chain&) = delete;
+        Chain& operator=(const Chain&) = delete;
+
+        // `operation` must be the operation that was prepared last
+        void add(OperationHandle operation)
+        {
+            assert(operation && size_ < N);
+            // The last operation ends the chain
+            if (size_ + 1 < N) {
+                io_.linkLastOperation(operation, hardLink_);
+            }
+            auto& step = steps_[size_];
+            step.chain = this;
+            step.operation = operation;
+            operation.setCompleter(&step);
+            size_++;
+            pending_++;
+        }
+
+        // If fewer than N operations were added (e.g. because preparing one failed), the chain ends
+        // after the last one and the results of the missing ones are empty.
+        bool await_ready() noexcept
+        {
+            endEarly();
+            return pending_ == 0;
+        }
+
+        void await_suspend(std::coroutine_handle<> handle) noexcept { caller_ = handle; }
+
+        std::array<IoResult, N> await_resume() const noexcept { return results_; }
+
+        class StepAwaiter {
+        public:
+            StepAwaiter(Chain& chain, size_t index)
+                : chain_(chain)
+                , index_(index)
+            {
+            }
+
+            bool await_ready() const noexcept { return chain_.steps_[index_].done; }
+
+            void await_suspend(std::coroutine_handle<> handle) noexcept
+            {
+                chain_.steps_[index_].waiter = handle;
+            }
+
+            IoResult await_resume() const noexcept { return chain_.results_[index_]; }
+
+        private:
+            Chain& chain_;
+            size_t index_;
+        };
+
+        // Cancels all operations that have not completed yet. They still complete (usually with
+        // ECANCELED), so the chain must still be awaited.
+        void cancel()
+        {
+            for (auto& step : steps_) {
+                if (step.operation) {
+                    step.operation.cancel(false);
+                }
+            }
+        }
+
+        // Resumes once the operation at `index` completed and returns its result, so the caller
+        // can react to it while the rest of the chain is still running. The chain must still be
+        // awaited afterwards (or destroyed, which cancels the rest).
+        StepAwaiter step(size_t index)
+        {
+            assert(index < size_);
+            endEarly();
+            return StepAwaiter(*this, index);
+        }
+
+    private:
+        struct Step final : public Completer {
+            Chain* chain = nullptr;
+            OperationHandle operation;
+            std::coroutine_handle<> waiter = {};
+            bool done = false;
+
+            void complete(IoResult result, uint32_t) override
+            {
+                operation = {};
+                chain->stepCompleted(this, result);
+            }
+        };
+
+        // The last operation that was added must not stay linked to whatever is prepared next and
+        // the SQEs of the missing ones must not stay reserved.
+        void endEarly()
+        {
+            if (size_ < N && !endedEarly_) {
+                io_.endChain(size_ > 0 ? steps_[size_ - 1].operation : OperationHandle {});
+                endedEarly_ = true;
+            }
+        }
+
+        void stepCompleted(Step* step, IoResult result)
+        {
+            results_[static_cast<size_t>(step - steps_.data())] = result;
+            step->done = true;
+            pending_--;
+            // The coroutine might await the whole chain next or even destroy it, so `this` must not
+            // be touched after resuming it.
+            if (step->waiter) {
+                std::exchange(step->waiter, nullptr).resume();
+            } else if (pending_ == 0 && caller_) {
+                caller_.resume();
+            }
+        }
+
+        IoQueue& io_;
+        bool hardLink_;
+        std::array<Step, N> steps_;
+        std::array<IoResult, N> results_;
+        size_t size_ = 0;
+        size_t pending_ = 0;
+        bool endedEarly_ = false;
+        std::coroutine_handle<> caller_ = {};
+    };
+
+    // See sleepUntil. The awaiter is the timer itself, so nothing has to be allocated.
+    class SleepAwaiter final : public Timer {
+    public:
+        SleepAwaiter(IoQueue& io, TimePoint deadline);
+
+        bool await_ready() const noexcept;
+        void await_suspend(std::coroutine_handle<> handle) noexcept;
+        void await_resume() const noexcept { }
+
+    protected:
+        void expired() override;
+
+    private:
+        IoQueue& io_;
+        TimePoint deadline_;
+        std::coroutine_handle<> caller_ = {};
+    };
+
+    // See withDeadline
+    struct DeadlineAwaiter final : public OperationAwaiter, public Timer {
+        TimePoint deadline;
+
+        DeadlineAwaiter(OperationHandle operation, TimePoint deadline);
+
+        void await_suspend(std::coroutine_handle<> handle) noexcept;
+
+        void complete(IoResult res, uint32_t cqeFlags) override;
+
+    protected:
+        void expired() override;
+    };
+
+    // See withDeadline(Task<T>, TimePoint)
+    template <typename T>
+    class TaskDeadlineAwaiter final : public Timer {
+    public:
+        TaskDeadlineAwaiter(IoQueue& io, Task<T> task, TimePoint deadline)
+            : io_(io)
+            , task_(std::move(task))
+            , deadline_(deadline)
+        {
+        }
+
+        bool await_ready() noexcept { return task_.operator co_await().await_ready(); }
+
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<> handle) noexcept
+        {
+            caller_ = handle;
+            io_.armTimer(*this, deadline_);
+            // The task resumes the caller directly when it is done
+            return task_.operator co_await().await_suspend(handle);
+        }
+
+        // Returns std::nullopt (or false for Task<void>) if the deadline expired
+        auto await_resume() noexcept
+        {
+            if constexpr (std::is_void_v<T>) {
+                if (timedOut_) {
+                    return false;
+                }
+                Timer::cancel();
+                return true;
+            } else {
+                if (timedOut_) {
+                    return std::optional<T>();
+                }
+                Timer::cancel();
+                return std::optional<T>(task_.operator co_await().await_resume());
+            }
+        }
+
+    protected:
+        void expired() override
+        {
+            timedOut_ = true;
+            // Destroying the task destroys the awaiters of the operations it is (transitively)
+            // waiting on, which cancel them and remove their completers right away.
+            task_ = Task<T>();
+            caller_.resume();
+        }
+
+    private:
+        IoQueue& io_;
+        Task<T> task_;
+        TimePoint deadline_;
+        std::coroutine_handle<> caller_ = {};
+        bool timedOut_ = false;
+    };
+
+    // The io_uring setup flags that matter for performance. See io_uring_setup(2).
+    struct Options {
+        // Number of SQ entries and initial capacity for operations in flight
+        size_t size = 1024;
+        // 0 means twice the SQ size (IORING_SETUP_CQSIZE)
+        size_t completionQueueSize = 0;
+        // A kernel thread polls the SQ, so submissions don't need a syscall while it is awake. It
+        // goes to sleep after `sqPollIdle` (0 means the kernel default) and can be pinned to a CPU.
+        // This can't be combined with the task run modes below. (IORING_SETUP_SQPOLL)
+        bool submissionQueuePolling = false;
+        std::optional<int> sqPollCpu;
+        Duration sqPollIdle = Duration(0);
+        // Promise that only the thread that created the IoQueue submits to it
+        // (IORING_SETUP_SINGLE_ISSUER)
+        bool singleIssuer = false;
+        // Completion work is only done when run() asks for completions, instead of interrupting
+        // the thread whenever something completes. Implies singleIssuer.
+        // (IORING_SETUP_DEFER_TASKRUN)
+        bool deferTaskrun = false;
+        // Completion work does not interrupt the thread, but is done on the next syscall.
+        // (IORING_SETUP_COOP_TASKRUN with IORING_SETUP_TASKRUN_FLAG)
+        bool coopTaskrun = false;
+        // Keep submitting the rest of a batch if one SQE fails (IORING_SETUP_SUBMIT_ALL)
+        bool submitAll = false;
+    };
+
+    IoQueue(size_t size = 1024);
+    IoQueue(const Options& options);
+
+    ~IoQueue(); // We only need this to destruct incomplete IoQueueImpl
+
+    size_t getSize() const;
+
+    size_t getCapacity() const;
+
+    // Returns false if the table could not be registered. It can only be registered once.
+    // You need to register a file table for direct descriptors (see DirectFd). `size` is the
+    // maximum number of direct descriptors open at the same time.
+    bool registerFileTable(size_t size);
+
+    OperationHandle accept(AnyFd fd, ::sockaddr_in* addr, socklen_t* addrlen);
+    // The result is a direct descriptor (see DirectFd)
+    OperationHandle acceptDirect(AnyFd fd, ::sockaddr_in* addr, socklen_t* addrlen);
+
+    // The kernel accepts connections on `fd` until the stream is destroyed, which is cheaper than
+    // submitting a new accept for every connection.
+    // Since there is only a single address buffer for all completions, the peer address is
+    // determined with getpeername.
+    AcceptStream acceptMultishot(AnyFd fd);
+    // Like acceptMultishot, but every connection is a direct descriptor (see DirectFd) in a free
+    // slot of the file table. The peer address is not available.
+    DirectAcceptStream acceptMultishotDirect(AnyFd fd);
+
+    OperationHandle connect(AnyFd sockfd, const ::sockaddr* addr, socklen_t addrlen);
+    OperationHandle connect(AnyFd sockfd, const ::sockaddr_in* addr);
+    Task<IoResult> connect(AnyFd sockfd, IpAddressPort addr);
+
+    OperationHandle send(AnyFd sockfd, const void* buf, size_t len);
+
+    // Zero-copy sends are only worth it for large buffers (> ~10KB). See ZeroCopySend.
+    ZeroCopySend sendZc(AnyFd sockfd, const void* buf, size_t len);
+
+    OperationHandle recv(AnyFd sockfd, void* buf, size_t len);
+
+    // The kernel picks a buffer from `buffers` only once data has arrived.
+    // Awaiting this returns an empty ProvidedBuffer if the connection was closed.
+    ProvidedBufferAwaiter recv(AnyFd sockfd, BufferRing& buffers);
+
+    // A single receive operation that keeps receiving into buffers from `buffers` until the
+    // connection is closed or an error occurs.
+    RecvStream recvMultishot(AnyFd sockfd, BufferRing& buffers);
+
+    // For files, the offset is the position in the file. An offset of -1 (as uint64_t) means the
+    // current file position, which is then updated. It is ignored for sockets, pipes, etc.
+    OperationHandle read(AnyFd fd, void* buf, size_t count, uint64_t offset = 0);
+    OperationHandle write(AnyFd fd, const void* buf, size_t count, uint64_t offset = 0);
+    OperationHandle readv(AnyFd fd, const ::iovec* iov, int iovcnt, uint64_t offset = 0);
+    OperationHandle writev(AnyFd fd, const ::iovec* iov, int iovcnt, uint64_t offset = 0);
+
+    OperationHandle fsync(AnyFd fd);
+    OperationHandle fdatasync(AnyFd fd);
+
+    // These use a chunk of a RegisteredBufferPool, so the kernel does not have to pin the memory
+    // for every operation. `count` must not be larger than the chunk.
+    OperationHandle readFixed(AnyFd fd, RegisteredBuffer& buf, size_t count, uint64_t offset = 0);
+    // Reads into `buf` starting at `bufOffset`, e.g. to put a header in front of the data
+    OperationHandle readFixed(
+        AnyFd fd, RegisteredBuffer& buf, size_t bufOffset, size_t count, uint64_t offset);
+    OperationHandle writeFixed(
+        AnyFd fd, const RegisteredBuffer& buf, size_t count, uint64_t offset = 0);
+    OperationHandle sendFixed(AnyFd sockfd, const RegisteredBuffer& buf, size_t len);
+
+    OperationHandle close(AnyFd fd);
+
+    // Paths (and the statx buffer) must stay valid until the operation completed. See AsyncFile
+    // for a more convenient interface for files.
+    OperationHandle openat(int dirfd, const char* pathname, int flags, mode_t mode = 0);
+    // `how` only has to stay valid until the operation has been submitted, but it's easiest to keep
+    // it alive until it completed.
+    OperationHandle openat2(int dirfd, const char* pathname, const ::open_how* how);
+    OperationHandle statx(int dirfd, const char* pathname, int flags, unsigned int mask,
+        struct ::statx* statxbuf);
+    OperationHandle renameat(
+        int olddirfd, const char* oldpath, int newdirfd, const char* newpath, int flags = 0);
+    OperationHandle unlinkat(int dirfd, const char* pathname, int flags = 0);
+
+    // The result is a direct descriptor (see DirectFd)
+    OperationHandle openatDirect(int dirfd, const char* pathname, int flags, mode_t mode = 0);
+
+    OperationHandle shutdown(AnyFd fd, int how);
+
+    // Moves up to `len` bytes from `in` to `out` inside the kernel. One of them must be a pipe.
+    // An offset of -1 means there is none (pipes, sockets) or that the file position is used.
+    // The result is the number of bytes moved, 0 means end of file. See proxyBidirectional.
+    OperationHandle splice(
+        AnyFd in, int64_t inOffset, AnyFd out, int64_t outOffset, size_t len, unsigned flags = 0);
+    // Copies up to `len` bytes from pipe `in` to pipe `out` without consuming them from `in`
+    OperationHandle tee(AnyFd in, AnyFd out, size_t len, unsigned flags = 0);
+
+    OperationHandle poll(AnyFd fd, short events);
+
+    OperationHandle recvmsg(AnyFd sockfd, ::msghdr* msg, int flags);
+
+    OperationHandle sendmsg(AnyFd sockfd, const ::msghdr* msg, int flags);
+    ZeroCopySend sendmsgZc(AnyFd sockfd, const ::msghdr* msg, int flags);
 
     // These functions are just convenience wrappers on top of recvmsg and sendmsg.
     // They need to wrap the callback and allocate a ::msghdr and ::iovec on the heap.
     // This is also why addrLen is not an in-out parameter, but just an in-parameter.
     // If you need it to be fast, use recvmsg and sendmsg.
     Task<IoResult> recvfrom(
-        int sockfd, void* buf, size_t len, int flags, ::sockaddr* srcAddr, socklen_t addrLen);
+        AnyFd sockfd, void* buf, size_t len, int flags, ::sockaddr* srcAddr, socklen_t addrLen);
 
     template <typename SockAddr>
-    Task<IoResult> recvfrom(int sockfd, void* buf, size_t len, int flags, SockAddr* srcAddr)
+    Task<IoResult> recvfrom(AnyFd sockfd, void* buf, size_t len, int flags, SockAddr* srcAddr)
     {
         return recvfrom(
             sockfd, buf, len, flags, reinterpret_cast<::sockaddr*>(srcAddr), sizeof(SockAddr));
     }
 
-    Task<IoResult> sendto(int sockfd, const void* buf, size_t len, int flags,
+    Task<IoResult> sendto(AnyFd sockfd, const void* buf, size_t len, int flags,
         const ::sockaddr* destAddr, socklen_t addrLen);
 
     template <typename SockAddr>
     Task<IoResult> sendto(
-        int sockfd, const void* buf, size_t len, int flags, const SockAddr* destAddr)
+        AnyFd sockfd, const void* buf, size_t len, int flags, const SockAddr* destAddr)
     {
         return sendto(sockfd, buf, len, flags, reinterpret_cast<const ::sockaddr*>(destAddr),
             sizeof(SockAddr));
@@ -188,24 +721,132 @@ public:
     Task<IoResult> timeout(Duration dur);
     Task<IoResult> timeout(TimePoint tp);
 
-    // The passed operation will return ECANCELED in case the timeout expired.
+    // The passed operation will return ECANCELED in case the timeout expired. If it was the last
+    // operation that was prepared, a linked timeout is used. Otherwise see withDeadline.
     Task<IoResult> timeout(Duration dur, OperationHandle op);
     Task<IoResult> timeout(TimePoint tp, OperationHandle op);
 
+    // Timers are kept in a hierarchical timing wheel with a resolution of one millisecond (see
+    // TimerWheel), which is driven by a single kernel timeout. Arming, re-arming and canceling a
+    // timer only needs an SQE if it expires before all other armed timers, so pushing back the
+    // idle deadline of a connection every time something is received is free.
+    // If `timer` is armed already, it is moved. It must stay valid until it expired or is canceled.
+    void armTimer(Timer& timer, TimePoint deadline);
+    void armTimer(Timer& timer, Duration timeout);
+
+    // `co_await io.sleepUntil(tp)` resumes the coroutine once `tp` has passed.
+    SleepAwaiter sleepUntil(TimePoint deadline);
+    SleepAwaiter sleepFor(Duration duration);
+
+    // Awaiting this awaits `operation`, which will return ECANCELED if it did not complete before
+    // `deadline`. Unlike timeout(tp, op), it works for any operation (not only the last one that
+    // was prepared) and it does not submit anything unless the deadline expires.
+    DeadlineAwaiter withDeadline(OperationHandle operation, TimePoint deadline);
+    DeadlineAwaiter withDeadline(OperationHandle operation, Duration timeout);
+
+    // Awaiting this awaits `task`, which may consist of many operations (e.g. sendAll). If the
+    // deadline expires first, the task is destroyed, which cancels the operation it is waiting on,
+    // and the result is std::nullopt (or false for Task<void>).
+    // The task must only wait on things that clean up after themselves when they are destroyed
+    // while suspended, like operations, timers and other tasks. It must not switch threads.
+    // The canceled operation completes asynchronously, so the kernel might still access its
+    // buffers after this returned. Buffers used by the task must outlive that completion (e.g. by
+    // keeping them until the fd is closed), so they can't live in the frame of the task.
+    template <typename T>
+    TaskDeadlineAwaiter<T> withDeadline(Task<T> task, TimePoint deadline)
+    {
+        return TaskDeadlineAwaiter<T>(*this, std::move(task), deadline);
+    }
+
     template <typename T>
-    Task<T> wait(Future<T> future)
+    TaskDeadlineAwaiter<T> withDeadline(Task<T> task, Duration timeout)
     {
-        if (future.ready()) {
-            co_return future.get();
+        return TaskDeadlineAwaiter<T>(*this, std::move(task), TimePoint::clock::now() + timeout);
+    }
+
+    // Resumes the awaiting coroutine once the value is set. All futures waited on share the
+    // completion inbox of this IoQueue, so when many of them complete at once, there is only a
+    // single eventfd write and read for all of them.
+    template <typename T>
+    class FutureAwaiter {
+    public:
+        FutureAwaiter(IoQueue& io, Future<T> future)
+            : io_(io)
+            , future_(std::move(future))
+        {
+        }
+
+        FutureAwaiter(const FutureAwaiter&) = delete;
+        FutureAwaiter& operator=(const FutureAwaiter&) = delete;
+
+        // If the awaiting coroutine is destroyed while it is suspended
+        ~FutureAwaiter()
+        {
+            if (waiting_ && future_.removeInboxWaiter()) {
+                io_.removeInboxWaiter();
+            }
         }
-        const auto res = co_await future.getEventFd().read(*this);
-        if (!res) {
-            getLogger().log(
-                LogSeverity::Fatal, "Error reading from eventfd: " + res.error().message());
-            std::abort();
+
+        bool await_ready() const { return future_.ready(); }
+
+        bool await_suspend(std::coroutine_handle<> handle)
+        {
+            if (!future_.setInboxWaiter(&io_.getCompletionInbox(), handle)) {
+                // It was set in the meantime
+                return false;
+            }
+            waiting_ = true;
+            io_.addInboxWaiter();
+            return true;
+        }
+
+        T await_resume()
+        {
+            waiting_ = false;
+            return future_.get();
         }
-        assert(*res == 1);
-        co_return future.get();
+
+    private:
+        IoQueue& io_;
+        Future<T> future_;
+        bool waiting_ = false;
+    };
+
+    template <typename T>
+    FutureAwaiter<T> wait(Future<T> future)
+    {
+        return FutureAwaiter<T>(*this, std::move(future));
+    }
+
+    // Operations are usually submitted by run() together with everything else that was prepared
+    // while processing the current batch of completions. While the returned object is alive,
+    // operations are collected and when it is destroyed, they are all submitted right away with a
+    // single io_uring_enter, e.g. to get them started before processing the remaining completions
+    // or before run() is called. Batches may be nested and only the outermost one submits.
+    Batch batch();
+
+    // The operations added to the returned chain are linked (IOSQE_IO_LINK), so each one is only
+    // started once the previous one succeeded. Otherwise the remaining ones fail with ECANCELED.
+    // For reads, receives, sends, splices, etc. a short transfer (fewer bytes than requested)
+    // counts as a failure too.
+    // With `hardLink` (IOSQE_IO_HARDLINK) the chain continues after failures, so use it if later
+    // operations have to run regardless, like a close.
+    // Awaiting the chain resumes once all operations completed and returns all of their results.
+    // Exactly N operations must be added, each right after it was prepared:
+    //     auto chain = io.chain<3>(true);
+    //     chain.add(io.send(socket, buf, len));
+    //     chain.add(io.shutdown(socket, SHUT_WR));
+    //     chain.add(io.close(socket.release()));
+    //     const auto [sendRes, shutdownRes, closeRes] = co_await chain;
+    // SQEs for all of them are reserved up front, so the chain is never split by a submission.
+    // If fewer are added (e.g. because one could not be prepared), the chain ends after the last
+    // one once it is awaited or destroyed. Add nothing else in between.
+    // Single results can be awaited earlier with Chain::step.
+    template <size_t N>
+    Chain<N> chain(bool hardLink = false)
+    {
+        static_assert(N > 0);
+        return Chain<N>(*this, hardLink);
     }
 
     // Note that the cancelation can be asynchronous as well, so it is also possible that the
@@ -214,15 +855,75 @@ public:
     // function, and the handler will not be called in either case.
     OperationHandle cancel(OperationHandle operation, bool cancelHandler);
 
+    // These post a message to another IoQueue (usually running on another thread), which shows up
+    // as a completion there directly (IORING_OP_MSG_RING). There is no locking and no extra
+    // syscall, because the message is submitted with the next batch of SQEs of this IoQueue.
+    // They must be called from the thread running this IoQueue and they return false if no SQE
+    // could be acquired.
+    // Note that run() on `target` only waits for messages while it has operations in flight.
+
+    // `completer.complete(value, 0)` will be called on the thread running `target`. If the message
+    // can not be delivered, it is called on this IoQueue with the error instead.
+    bool post(IoQueue& target, Completer& completer, int32_t value = 0);
+
+    // `func` will be called on the thread running `target`. If the message can not be delivered,
+    // the error is logged and `func` is dropped.
+    bool post(IoQueue& target, Function<void()> func);
+
+    // `handle` will be resumed on the thread running `target`. If the message can not be
+    // delivered, it is resumed on this IoQueue instead.
+    bool post(IoQueue& target, std::coroutine_handle<> handle);
+
+    // Installs the direct descriptor `fd` (see DirectFd) in the file table of `target` and calls
+    // `completer.complete(newIndex, 0)` on the thread running `target`. Both need a registered file
+    // table. `fd` stays open on this IoQueue, so close it after the returned operation completed.
+    // If that fails, `completer` is not called.
+    OperationHandle postDirectFd(IoQueue& target, AnyFd fd, Completer& completer);
+
+    // Number of operations in flight. It is only updated once per batch of completions, but it can
+    // be read from any thread, e.g. for load balancing.
+    size_t getNumOperationsInFlight() const;
+
+    // `co_await io.switchTo(other)` continues the coroutine on the thread running `other`.
+    // The result is false if the coroutine could not be moved and it is still running on `io`.
+    SwitchAwaiter switchTo(IoQueue& target);
+
+    // Runs until there are no more operations in flight or stop() is called.
     void run();
 
+    // Makes run() return after the current batch of completions has been processed. Operations
+    // that are still in flight are not canceled and will complete when run() is called again.
+    // This must be called from the thread that calls run().
+    void stop();
+
 private:
     friend struct IoQueueImpl;
+    friend class BufferRing;
+    friend class RegisteredBufferPool;
+
+    void setCompleter(OperationHandle operation, Completer* completer);
 
-    void setCompleter(OperationHandle operation, std::unique_ptr<Completer> completer);
-    OperationId getNextOpId();
+    void reserveSqes(size_t num);
+    void linkLastOperation(OperationHandle operation, bool hardLink);
+    void endChain(OperationHandle lastOperation);
+
+    detail::CompletionInbox& getCompletionInbox();
+    void addInboxWaiter();
+    void removeInboxWaiter();
 
-    OperationId nextOpId_ = 0;
     std::unique_ptr<IoQueueImpl> impl_;
 };
+
+// See IoQueue::withDeadline
+inline IoQueue::DeadlineAwaiter withTimeout(
+    IoQueue& io, IoQueue::OperationHandle operation, IoQueue::Duration timeout)
+{
+    return io.withDeadline(operation, timeout);
+}
+
+template <typename T>
+IoQueue::TaskDeadlineAwaiter<T> withTimeout(IoQueue& io, Task<T> task, IoQueue::Duration timeout)
+{
+    return io.withDeadline(std::move(task), timeout);
+}
 }
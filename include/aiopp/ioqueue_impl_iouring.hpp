@@ -1,5 +1,7 @@
 #pragma once
 
+#include <atomic>
+
 #include "completermap.hpp"
 #include "ioqueue.hpp"
 #include "iouring.hpp"
@@ -19,24 +21,108 @@ struct IoQueueImpl {
     IoQueue* parent_;
     IoURing ring_;
     CompleterMap completers_;
+    // The last SQE that was prepared, so it can be linked to the next one. It is only valid as
+    // long as ring_.getSubmitCount() is still lastSqeSubmitCount_ (see getLastSqe).
     io_uring_sqe* lastSqe_ = nullptr;
+    uint64_t lastSqeSubmitCount_ = 0;
+    uint16_t nextBufferGroupId_ = 0;
+    bool stopRequested_ = false;
+    bool deferTaskrun_ = false;
+    size_t batchDepth_ = 0;
+    // Operations with user_data OpIdIgnore (cancels, linked timeouts, etc.), which are not in
+    // completers_, but still post a CQE
+    size_t numIgnoredInFlight_ = 0;
+    std::atomic<size_t> numInFlight_ { 0 };
+
+    // See IoQueue::FutureAwaiter. The eventfd is only read while coroutines are waiting.
+    struct InboxReader final : public Completer {
+        IoQueueImpl* impl;
+        void complete(IoResult result, uint32_t flags) override;
+    };
+    detail::CompletionInbox completionInbox_;
+    InboxReader inboxReader_;
+    uint64_t inboxEventFdValue_ = 0;
+    // Waiters whose entries have not been taken from the inbox yet (including cancelled ones)
+    size_t numInboxWaiters_ = 0;
+    OperationHandle inboxRead_;
+    bool inboxReadInFlight_ = false;
+
+    // See IoQueue::armTimer. There is at most one kernel timeout in flight for the timer wheel,
+    // which expires at the next tick at which the wheel has something to do.
+    struct TimerTicker final : public Completer {
+        IoQueueImpl* impl;
+        void complete(IoResult result, uint32_t flags) override;
+    };
+    TimerWheel timerWheel_;
+    TimerTicker timerTicker_;
+    OperationHandle timerOp_;
+    uint64_t timerWakeTick_ = 0;
+    Timespec timerTimespec_ {};
+    Timespec timerUpdateTimespec_ {};
 
     IoQueueImpl(IoQueue* parent, size_t size);
-    bool init(bool submissionQueuePolling = false);
+    bool init(const IoQueue::Options& options);
+
+    // The user_data of messages from other rings (see IoQueue::post) has the highest bit set,
+    // which is never set in a CompleterMap key. The rest is a pointer to a Completer or, if the
+    // lowest bit is set, the address of a coroutine frame. Both are always aligned.
+    static constexpr uint64_t MessageTag = 1ull << 63;
+    static constexpr uint64_t MessageHandleTag = 1;
+
+    static uint64_t packMessage(Completer* completer);
+    static uint64_t packMessage(std::coroutine_handle<> handle);
+    static void completeMessage(uint64_t userData, IoResult result);
+
+    bool registerFileTable(size_t size);
+
+    void addInboxWaiter();
+    void removeInboxWaiter();
+    void armInboxRead();
+
+    void armTimer(Timer& timer, TimePoint deadline);
+    void scheduleTimerTick();
+    void cancelIdleTimerTick();
 
     size_t getSize() const;
     size_t getCapacity() const;
 
-    OperationHandle accept(int fd, ::sockaddr_in* addr, socklen_t* addrlen);
-    OperationHandle connect(int sockfd, const ::sockaddr* addr, socklen_t addrlen);
-    OperationHandle send(int sockfd, const void* buf, size_t len);
-    OperationHandle recv(int sockfd, void* buf, size_t len);
-    OperationHandle read(int fd, void* buf, size_t count);
-    OperationHandle close(int fd);
-    OperationHandle shutdown(int fd, int how);
-    OperationHandle poll(int fd, short events);
-    OperationHandle recvmsg(int sockfd, ::msghdr* msg, int flags);
-    OperationHandle sendmsg(int sockfd, const ::msghdr* msg, int flags);
+    OperationHandle accept(AnyFd fd, ::sockaddr_in* addr, socklen_t* addrlen);
+    OperationHandle acceptDirect(AnyFd fd, ::sockaddr_in* addr, socklen_t* addrlen);
+    OperationHandle acceptMultishot(AnyFd fd);
+    OperationHandle acceptMultishotDirect(AnyFd fd);
+    OperationHandle connect(AnyFd sockfd, const ::sockaddr* addr, socklen_t addrlen);
+    OperationHandle send(AnyFd sockfd, const void* buf, size_t len);
+    OperationHandle sendZc(AnyFd sockfd, const void* buf, size_t len);
+    OperationHandle recv(AnyFd sockfd, void* buf, size_t len);
+    OperationHandle recv(AnyFd sockfd, uint16_t bufferGroupId);
+    OperationHandle recvMultishot(AnyFd sockfd, uint16_t bufferGroupId);
+    OperationHandle read(AnyFd fd, void* buf, size_t count, uint64_t offset);
+    OperationHandle write(AnyFd fd, const void* buf, size_t count, uint64_t offset);
+    OperationHandle readv(AnyFd fd, const ::iovec* iov, int iovcnt, uint64_t offset);
+    OperationHandle writev(AnyFd fd, const ::iovec* iov, int iovcnt, uint64_t offset);
+    OperationHandle fsync(AnyFd fd, uint32_t flags);
+    OperationHandle readFixed(
+        AnyFd fd, void* buf, size_t count, uint16_t bufIndex, uint64_t offset);
+    OperationHandle writeFixed(
+        AnyFd fd, const void* buf, size_t count, uint16_t bufIndex, uint64_t offset);
+    OperationHandle sendFixed(AnyFd sockfd, const void* buf, size_t len, uint16_t bufIndex);
+    OperationHandle close(AnyFd fd);
+    OperationHandle openat(int dirfd, const char* pathname, int flags, mode_t mode);
+    OperationHandle openat2(int dirfd, const char* pathname, const ::open_how* how);
+    OperationHandle openatDirect(int dirfd, const char* pathname, int flags, mode_t mode);
+    OperationHandle statx(int dirfd, const char* pathname, int flags, unsigned int mask,
+        struct ::statx* statxbuf);
+    OperationHandle renameat(
+        int olddirfd, const char* oldpath, int newdirfd, const char* newpath, int flags);
+    OperationHandle unlinkat(int dirfd, const char* pathname, int flags);
+    OperationHandle shutdown(AnyFd fd, int how);
+    OperationHandle splice(
+        AnyFd in, int64_t inOffset, AnyFd out, int64_t outOffset, size_t len, unsigned flags);
+    OperationHandle tee(AnyFd in, AnyFd out, size_t len, unsigned flags);
+    OperationHandle poll(AnyFd fd, short events);
+    OperationHandle recvmsg(AnyFd sockfd, ::msghdr* msg, int flags);
+    OperationHandle sendmsg(AnyFd sockfd, const ::msghdr* msg, int flags);
+    OperationHandle sendmsgZc(AnyFd sockfd, const ::msghdr* msg, int flags);
 
     OperationHandle timeout(Timespec* ts, uint32_t flags);
     Task<IoResult> timeout(Duration dur);
@@ -50,10 +136,28 @@ struct IoQueueImpl {
 
     OperationHandle cancel(OperationHandle operation, bool cancelHandler);
 
+    void beginBatch();
+    void endBatch();
+    void linkLastOperation(OperationHandle operation, bool hardLink);
+    // Ends a chain that got fewer operations than were reserved. `lastOperation` may be invalid.
+    void endChain(OperationHandle lastOperation);
+
+    bool post(IoQueueImpl& target, uint64_t message, int32_t value);
+    bool post(IoQueue& target, Function<void()> func);
+    OperationHandle postDirectFd(IoQueueImpl& target, int index, uint64_t message);
+
     void run();
+    // Whether run() has to keep going, because CQEs are expected or SQEs are waiting to be
+    // submitted. Messages (post, switchTo) only have a CQE on this ring if they fail, so they are
+    // only accounted for until they have been submitted.
+    bool hasPendingWork() const;
 
     OperationHandle finalizeSqe(io_uring_sqe* sqe, uint64_t userData);
     OperationHandle finalizeSqe(io_uring_sqe* sqe);
-    void setCompleter(OperationHandle operation, std::unique_ptr<Completer> completer);
+    void setLastSqe(io_uring_sqe* sqe);
+    // Returns the SQE of `operation` if it was the last one prepared and has not been submitted
+    // since, so it can still be modified. Otherwise returns nullptr.
+    io_uring_sqe* getLastSqe(OperationHandle operation) const;
+    void setCompleter(OperationHandle operation, Completer* completer);
 };
 }
\ No newline at end of file
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <cstdint>
+#include <deque>
 #include <optional>
 
 #include <linux/time_types.h>
@@ -36,26 +37,82 @@ public:
     IoURing& operator=(IoURing&&) = delete;
 
     bool init(size_t sqEntries = 128, bool sqPoll = false);
+    // `params` (flags, sq_thread_cpu, sq_thread_idle, cq_entries) is passed to io_uring_setup.
+    bool init(size_t sqEntries, const io_uring_params& params);
     bool isInitialized() const;
 
     const io_uring_params& getParams() const;
+    int getRingFd() const;
 
     io_uring_cqe* peekCqe();
     io_uring_cqe* waitCqe(size_t num = 1);
     void advanceCq(size_t num = 1);
+    size_t getNumCqeReady() const;
+
+    // Calls func for every CQE that is currently in the CQ and returns the number of CQEs visited.
+    // This does not advance the CQ, so you have to call advanceCq with the returned count
+    // afterwards.
+    template <typename Func>
+    size_t forEachCqe(Func&& func)
+    {
+        unsigned head;
+        io_uring_cqe* cqe;
+        size_t count = 0;
+        io_uring_for_each_cqe(&ring_, head, cqe)
+        {
+            func(cqe);
+            count++;
+        }
+        return count;
+    }
+
+    // Registers a file table with `num` empty slots for direct descriptors. Sets errno on failure.
+    bool registerFilesSparse(size_t num);
+
+    // Sets errno on failure
+    bool registerBuffers(const iovec* iovecs, size_t numIovecs);
+    void unregisterBuffers();
+
+    // Registers a provided buffer ring (IORING_REGISTER_PBUF_RING). Sets errno on failure.
+    io_uring_buf_ring* setupBufferRing(unsigned int numEntries, uint16_t groupId);
+    void freeBufferRing(io_uring_buf_ring* bufRing, unsigned int numEntries, uint16_t groupId);
 
     size_t getNumSqeEntries() const;
     size_t getSqeCapacity() const;
+    // If the SQ is full, this submits the prepared SQEs to make room. If there is still no room
+    // (e.g. with SQPOLL or while the CQ is full), the SQE is put into an overflow queue in
+    // userspace instead, so this never returns nullptr. Once the overflow queue is not empty, all
+    // SQEs go there to keep them in order, until flushOverflow has moved them to the SQ.
+    // Since submitting in the middle of a link chain would break it, chains must only be started
+    // if there is enough room or the overflow queue is used already.
     io_uring_sqe* getSqe();
+    // Moves SQEs from the overflow queue to the SQ while there is room. Link chains are only moved
+    // as a whole. Returns the number of SQEs left in the overflow queue.
+    size_t flushOverflow();
+    size_t getNumOverflowSqes() const;
+    // Makes sure the next `num` SQEs end up in the SQ without a submission in between, so they can
+    // form a link chain. If there is not enough room, they all go into the overflow queue.
+    void reserveSqes(size_t num);
+    // Drops what is left of the last reservation, if fewer SQEs were prepared than reserved
+    void releaseReservedSqes();
     int submitSqes(size_t waitCqes = 0);
+    // Submits and runs pending task work without waiting, which is how completions are posted with
+    // IORING_SETUP_DEFER_TASKRUN. This always enters the kernel.
+    int submitSqesAndGetEvents();
+    size_t getNumSqeReady() const;
+    // Incremented whenever SQEs might have been submitted (including getSqe and reserveSqes) or
+    // moved out of the overflow queue. Pointers to SQEs prepared before must not be used anymore.
+    uint64_t getSubmitCount() const { return submitCount_; }
 
     io_uring_sqe* prepare(uint8_t opcode, int fd, uint64_t off, const void* addr, uint32_t len);
     io_uring_sqe* prepareNop();
     io_uring_sqe* prepareReadv(int fd, const iovec* iov, int iovcnt, off_t offset = 0);
     io_uring_sqe* prepareWritev(int fd, const iovec* iov, int iovcnt, off_t offset = 0);
     io_uring_sqe* prepareFsync(int fd, uint32_t flags = 0);
-    // io_uring_sqe* prepareReadFixed();
-    // io_uring_sqe* prepareWriteFixed();
+    io_uring_sqe* prepareReadFixed(
+        int fd, void* buf, size_t count, uint16_t bufIndex, off_t offset = 0);
+    io_uring_sqe* prepareWriteFixed(
+        int fd, const void* buf, size_t count, uint16_t bufIndex, off_t offset = 0);
     io_uring_sqe* preparePollAdd(int fd, short events, uint32_t flags = 0);
     io_uring_sqe* preparePollRemove(uint64_t userData);
     io_uring_sqe* prepareSyncFileRange(
@@ -64,13 +121,33 @@ public:
     io_uring_sqe* prepareRecvmsg(int sockfd, const msghdr* msg, int flags = 0);
     io_uring_sqe* prepareTimeout(Timespec* ts, uint64_t count, uint32_t flags = 0);
     io_uring_sqe* prepareTimeoutRemove(uint64_t userData, uint32_t flags);
+    // Changes the expiration of the timeout with user_data = userData
+    io_uring_sqe* prepareTimeoutUpdate(Timespec* ts, uint64_t userData, uint32_t flags = 0);
     io_uring_sqe* prepareAccept(int sockfd, sockaddr* addr, socklen_t* addrlen, uint32_t flags = 0);
+    // The CQE result is the index in the registered file table. Pass an index to use that slot.
+    io_uring_sqe* prepareAcceptDirect(int sockfd, sockaddr* addr, socklen_t* addrlen,
+        uint32_t flags = 0, uint32_t fileIndex = IORING_FILE_INDEX_ALLOC);
+    io_uring_sqe* prepareAcceptMultishot(
+        int sockfd, sockaddr* addr, socklen_t* addrlen, uint32_t flags = 0);
+    // Every connection gets a free slot in the registered file table
+    io_uring_sqe* prepareAcceptMultishotDirect(
+        int sockfd, sockaddr* addr, socklen_t* addrlen, uint32_t flags = 0);
     io_uring_sqe* prepareAsyncCancel(uint64_t userData);
+    // Posts a CQE with res = len and user_data = data to the ring with fd targetRingFd
+    io_uring_sqe* prepareMsgRing(int targetRingFd, uint32_t len, uint64_t data, uint32_t flags = 0);
+    // Installs the direct descriptor sourceIndex of this ring into the file table of the target
+    // ring and posts a CQE with res = the new index (or 0 if targetIndex is given) and
+    // user_data = data there.
+    io_uring_sqe* prepareMsgRingFd(int targetRingFd, uint32_t sourceIndex, uint64_t data,
+        uint32_t targetIndex = IORING_FILE_INDEX_ALLOC, uint32_t flags = 0);
     io_uring_sqe* prepareLinkTimeout(Timespec* ts, uint32_t flags = 0);
     io_uring_sqe* prepareConnect(int sockfd, const sockaddr* addr, socklen_t addrlen);
     // io_uring_sqe* prepareFallocate();
     io_uring_sqe* prepareOpenat(int dirfd, const char* pathname, int flags, mode_t mode);
+    io_uring_sqe* prepareOpenatDirect(int dirfd, const char* pathname, int flags, mode_t mode,
+        uint32_t fileIndex = IORING_FILE_INDEX_ALLOC);
     io_uring_sqe* prepareClose(int fd);
+    io_uring_sqe* prepareCloseDirect(uint32_t fileIndex);
     // io_uring_sqe* prepareFilesUpdate();
     io_uring_sqe* prepareStatx(
         int dirfd, const char* pathname, int flags, unsigned int mask, struct statx* statxbuf);
@@ -79,20 +156,35 @@ public:
     // io_uring_sqe* prepareFadvise();
     // io_uring_sqe* prepareMadvise();
     io_uring_sqe* prepareSend(int sockfd, const void* buf, size_t len, int flags = 0);
+    // IORING_OP_SEND rejects IORING_RECVSEND_FIXED_BUF (only the zero-copy sends take it), so this
+    // is a IORING_OP_WRITE_FIXED on the socket, which is the same as a send without flags.
+    io_uring_sqe* prepareSendFixed(int sockfd, const void* buf, size_t len, uint16_t bufIndex);
+    io_uring_sqe* prepareSendZc(
+        int sockfd, const void* buf, size_t len, int flags = 0, uint16_t zcFlags = 0);
+    io_uring_sqe* prepareSendmsgZc(
+        int sockfd, const msghdr* msg, int flags = 0, uint16_t zcFlags = 0);
     io_uring_sqe* prepareRecv(int sockfd, void* buf, size_t len, int flags = 0);
+    // A len of 0 means the whole buffer
+    io_uring_sqe* prepareRecvBufferSelect(
+        int sockfd, uint16_t bufferGroupId, size_t len = 0, int flags = 0);
+    io_uring_sqe* prepareRecvMultishot(int sockfd, uint16_t bufferGroupId, int flags = 0);
     io_uring_sqe* prepareOpenat2(int dirfd, const char* pathname, const open_how* how);
     io_uring_sqe* prepareEpollCtl(int epfd, int op, int fd, epoll_event* event);
-    // io_uring_sqe* prepareSplice(int fd_in, loff_t* off_in, int fd_out, loff_t* off_out,
-    //                             size_t len, unsigned int flags);
+    // An offset of -1 means there is none (pipes, sockets) or the file position should be used.
+    io_uring_sqe* prepareSplice(
+        int fdIn, int64_t offIn, int fdOut, int64_t offOut, size_t len, unsigned int flags = 0);
     // io_uring_sqe* prepareProvideBuffers();
     // io_uring_sqe* prepareRemoveBuffers();
-    // io_uring_sqe* prepareTee(int fdIn, int fdOut, size_t len, unsigned int flags);
+    io_uring_sqe* prepareTee(int fdIn, int fdOut, size_t len, unsigned int flags = 0);
     io_uring_sqe* prepareShutdown(int fd, int how);
     io_uring_sqe* prepareRenameat(
         int olddirfd, const char* oldpath, int newdirfd, const char* newpath, int flags = 0);
     io_uring_sqe* prepareUnlinkat(int dirfd, const char* pathname, int flags = 0);
 
 private:
+    std::deque<io_uring_sqe> overflow_;
+    size_t numReservedOverflow_ = 0;
+    uint64_t submitCount_ = 0;
     io_uring ring_;
     io_uring_params params_;
 };
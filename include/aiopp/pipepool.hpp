@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstddef>
+#include <optional>
+#include <vector>
+
+#include "aiopp/fd.hpp"
+
+namespace aiopp {
+// Splicing between two sockets needs a pipe in between. Creating one for every connection is a
+// syscall and two file descriptors, so they are pooled instead.
+// The pipes are non-blocking, so io_uring can poll them instead of punting to a worker thread.
+// This is not thread-safe. Use one pool per thread/IoQueue.
+class PipePool {
+public:
+    // If `pipeSize` is not 0, the capacity of new pipes is set to it (F_SETPIPE_SZ).
+    // At most `maxPooled` pipes are kept, the rest is closed when released.
+    PipePool(size_t pipeSize = 0, size_t maxPooled = 1024);
+
+    // Logs an error and returns nullopt if a pipe could not be created
+    std::optional<Pipe> acquire();
+
+    // Only pipes that are empty and still open on both ends may be given back. Close (or simply
+    // drop) the others.
+    void release(Pipe pipe);
+
+    size_t size() const;
+
+private:
+    size_t pipeSize_;
+    size_t maxPooled_;
+    std::vector<Pipe> pipes_;
+};
+}
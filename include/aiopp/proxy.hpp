@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <system_error>
+
+#include "aiopp/fd.hpp"
+#include "aiopp/ioqueue.hpp"
+#include "aiopp/pipepool.hpp"
+#include "aiopp/task.hpp"
+
+namespace aiopp {
+struct ProxyResult {
+    uint64_t bytesAToB = 0;
+    uint64_t bytesBToA = 0;
+    // The first error in either direction, if any
+    std::error_code error;
+};
+
+// Keeps splicing until `len` bytes have been moved from `in` to `out`, e.g. to empty a pipe into a
+// socket after a short splice. Neither of them may have an offset. Running into EOF is an error.
+Task<IoResult> spliceAll(IoQueue& io, AnyFd in, AnyFd out, size_t len);
+
+// Forwards data between the connected sockets `a` and `b` in both directions until both sides have
+// closed their end (or an error occurs) and never copies it to userspace.
+// Each direction is a hard linked pair of splices (socket -> pipe -> socket) with a pipe from
+// `pipes`, so the second one runs even if the first one moved less than `chunkSize`.
+// An EOF in one direction is forwarded with shutdown(SHUT_WR). After an error both sockets are
+// shut down completely. The sockets are not closed and must outlive the task.
+Task<ProxyResult> proxyBidirectional(
+    IoQueue& io, AnyFd a, AnyFd b, PipePool& pipes, size_t chunkSize = 64 * 1024);
+}
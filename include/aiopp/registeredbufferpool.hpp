@@ -0,0 +1,80 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+namespace aiopp {
+class IoQueue;
+class RegisteredBufferPool;
+
+// A chunk of a RegisteredBufferPool. It is given back to the pool when this object is destroyed
+// (or release is called), so it must outlive all operations that use it.
+class RegisteredBuffer {
+public:
+    RegisteredBuffer() = default;
+    RegisteredBuffer(RegisteredBufferPool* pool, uint16_t index, std::byte* data, size_t size);
+    RegisteredBuffer(RegisteredBuffer&& other);
+    RegisteredBuffer(const RegisteredBuffer&) = delete;
+    ~RegisteredBuffer();
+
+    RegisteredBuffer& operator=(RegisteredBuffer&& other);
+    RegisteredBuffer& operator=(const RegisteredBuffer&) = delete;
+
+    explicit operator bool() const { return pool_ != nullptr; }
+
+    // The index of the registered buffer (buf_index)
+    uint16_t index() const { return index_; }
+    std::byte* data() const { return data_; }
+    size_t size() const { return size_; }
+    std::span<std::byte> span() const { return { data_, size_ }; }
+
+    void release();
+
+private:
+    RegisteredBufferPool* pool_ = nullptr;
+    uint16_t index_ = 0;
+    std::byte* data_ = nullptr;
+    size_t size_ = 0;
+};
+
+// A single memory region, split into equally sized chunks, each of which is registered with the
+// kernel (io_uring_register_buffers). The kernel maps and pins the pages once during registration
+// instead of for every operation, which is what makes IoQueue::readFixed, writeFixed and sendFixed
+// cheaper than their regular counterparts.
+// There can only be a single RegisteredBufferPool per IoQueue. It must outlive all
+// RegisteredBuffers and must be destroyed before the IoQueue.
+class RegisteredBufferPool {
+public:
+    // numChunks must be at most 16384. If hugePages is true, the pool will try to use huge pages
+    // and fall back to regular pages if that fails.
+    RegisteredBufferPool(IoQueue& io, size_t numChunks, size_t chunkSize, bool hugePages = false);
+    ~RegisteredBufferPool();
+
+    RegisteredBufferPool(const RegisteredBufferPool&) = delete;
+    RegisteredBufferPool& operator=(const RegisteredBufferPool&) = delete;
+
+    explicit operator bool() const { return registered_; }
+
+    size_t getNumChunks() const { return numChunks_; }
+    size_t getChunkSize() const { return chunkSize_; }
+    size_t getNumAvailable() const { return freeChunks_.size(); }
+
+    // Returns an empty RegisteredBuffer if all chunks are in use
+    RegisteredBuffer acquire();
+
+    void release(uint16_t index);
+
+private:
+    std::byte* getChunkData(uint16_t index) const;
+
+    IoQueue& io_;
+    size_t numChunks_;
+    size_t chunkSize_;
+    std::byte* memory_ = nullptr;
+    size_t mappingSize_ = 0;
+    bool registered_ = false;
+    std::vector<uint16_t> freeChunks_;
+};
+}
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <system_error>
+#include <utility>
 #include <variant>
 
 namespace aiopp {
@@ -33,6 +34,11 @@ public:
     {
     }
 
+    Result(T&& t)
+        : value_(std::move(t))
+    {
+    }
+
     template <typename U>
     Result(ErrorWrapper<U>&& e)
         : value_(E { e.value })
@@ -49,6 +55,7 @@ public:
     T& operator*() { return value(); }
 
     const T* operator->() const { return &value(); }
+    T* operator->() { return &value(); }
 
     const E& error() const { return std::get<1>(value_); }
 
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <atomic>
+#include <latch>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "aiopp/eventfd.hpp"
+#include "aiopp/function.hpp"
+#include "aiopp/ioqueue.hpp"
+#include "aiopp/mpscqueue.hpp"
+#include "aiopp/socket.hpp"
+
+namespace aiopp {
+// A thread-per-core runtime: One thread per core, each running its own IoQueue.
+// Everything running on one IoQueue stays on that thread, so there is no synchronization
+// necessary, unless you explicitly move work to another core with spawnOn.
+class Runtime {
+public:
+    struct Options {
+        // 0 means one thread for every CPU this process may run on
+        size_t numThreads = 0;
+        // Pin thread i to the i-th CPU this process may run on
+        bool pinThreads = true;
+        // Every IoQueue is created by and only submitted to from its own thread, so singleIssuer
+        // and deferTaskrun may be used.
+        IoQueue::Options ioQueue;
+    };
+
+    Runtime();
+    Runtime(Options options);
+
+    // Calls stop() and join()
+    ~Runtime();
+
+    Runtime(const Runtime&) = delete;
+    Runtime& operator=(const Runtime&) = delete;
+
+    size_t getNumCores() const;
+
+    // Only use this IoQueue from its own thread (i.e. from functions passed to spawnOn)!
+    IoQueue& getIoQueue(size_t core);
+
+    // This is thread-safe. `func` will be called on the thread of the given core.
+    // Pass a lambda that calls a coroutine function (e.g. returning BasicCoroutine) to spawn a
+    // task.
+    void spawnOn(size_t core, Function<void(IoQueue&)> func);
+
+    // `func` will be called with the IoQueue and the index of each core on that core's thread.
+    template <typename Func>
+    void spawnOnEach(Func func)
+    {
+        for (size_t core = 0; core < workers_.size(); ++core) {
+            spawnOn(core, [func, core](IoQueue& io) { func(io, core); });
+        }
+    }
+
+    // Creates one listening socket per core with SO_REUSEPORT, so the kernel will distribute
+    // connections between them. If steerToCpu is true, a BPF program is attached, that makes the
+    // socket of the core pinned to the CPU that received the connection accept it (see
+    // attachReusePortCpuSteering). This also works if the allowed CPUs are not 0..N-1, but it is
+    // only meaningful with pinThreads.
+    // Socket i should be used on core i. Returns an empty vector on error.
+    std::vector<Fd> createListenSockets(
+        const IpAddressPort& listenAddress, int backlog = SOMAXCONN, bool steerToCpu = false);
+
+    // Registers a function that is called on the thread of `core` when the runtime is stopped,
+    // before its IoQueue stops. Use it to cancel long-running operations (like accepts) and close
+    // connections. This may only be called from the thread of `core`.
+    void onStop(size_t core, Function<void(IoQueue&)> handler);
+
+    // This is thread-safe and it may be called from any of the cores too. It returns immediately.
+    // Every core will call its stop handlers, process the completions that are ready and then stop.
+    // Operations that are still in flight at that point are abandoned.
+    void stop();
+
+    // Blocks until all threads have stopped
+    void join();
+
+private:
+    struct Worker {
+        std::unique_ptr<IoQueue> io;
+        std::thread thread;
+        MpscQueue<Function<void(IoQueue&)>> inbox;
+        EventFd inboxEventFd;
+        std::vector<Function<void(IoQueue&)>> stopHandlers;
+        int cpu = -1; // -1 if not pinned
+    };
+
+    void workerFunc(Worker& worker, int cpu, std::latch& started);
+    BasicCoroutine processInbox(Worker& worker);
+
+    Options options_;
+    std::vector<std::unique_ptr<Worker>> workers_;
+    std::atomic<bool> stopRequested_ { false };
+};
+}
@@ -2,6 +2,7 @@
 
 #include <cstdint>
 #include <optional>
+#include <span>
 #include <string>
 
 #include <netinet/in.h>
@@ -63,9 +64,24 @@ struct IpAddressPort {
 };
 
 Fd createSocket(SocketType type);
-Fd createSocket(SocketType type, const IpAddressPort& bindAddress, bool reuseAddr = false);
+Fd createSocket(SocketType type, const IpAddressPort& bindAddress, bool reuseAddr = false,
+    bool reusePort = false);
 
 bool bind(const Fd& fd, const IpAddressPort& address);
 
-Fd createTcpListenSocket(const IpAddressPort& listenAddress, int backlog = SOMAXCONN);
+// With reusePort multiple sockets can listen on the same address and the kernel distributes
+// incoming connections between them.
+Fd createTcpListenSocket(
+    const IpAddressPort& listenAddress, int backlog = SOMAXCONN, bool reusePort = false);
+
+// Attaches a classic BPF program to a SO_REUSEPORT group (which `socket` is part of), that makes
+// the kernel pick socket `cpu % numSockets` for a new connection, where `cpu` is the CPU that
+// handles the incoming packet. The index refers to the order in which the sockets were bound.
+// If socket i is served by a thread pinned to CPU i, connections stay on one CPU.
+bool attachReusePortCpuSteering(const Fd& socket, size_t numSockets);
+
+// Like above, but socket i is picked for connections handled by CPU socketCpus[i]. Use this if the
+// threads are not pinned to CPUs 0..N-1 (e.g. because of taskset or cgroup cpusets). Connections
+// on CPUs that are not in the list are distributed with `cpu % numSockets`.
+bool attachReusePortCpuSteering(const Fd& socket, std::span<const int> socketCpus);
 }
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+#include <sys/stat.h>
+
+#include "aiopp/fd.hpp"
+#include "aiopp/ioqueue.hpp"
+#include "aiopp/pipepool.hpp"
+#include "aiopp/registeredbufferpool.hpp"
+#include "aiopp/result.hpp"
+#include "aiopp/task.hpp"
+
+namespace aiopp {
+// A regular file opened for reading, with the metadata needed to serve it
+struct OpenFile {
+    Fd fd;
+    uint64_t size = 0;
+    ::statx_timestamp mtime = {};
+};
+
+// A bounded LRU cache of open files, keyed by their path relative to a root directory, so serving
+// a popular file does not cost an open, a statx and a close every time.
+// Files are opened with openat2 and RESOLVE_BENEATH, so paths can't escape the root directory (with
+// "..", absolute paths or symlinks).
+// Entries are reopened once they are older than `maxAge`, so changes are picked up eventually.
+// Files are shared with the callers, so evicting a file that is still being sent does not close it.
+// This is not thread-safe. Use one cache per thread/IoQueue.
+class OpenFileCache {
+public:
+    using Clock = std::chrono::steady_clock;
+    using FilePtr = std::shared_ptr<const OpenFile>;
+
+    // `rootDir` may be opened with O_PATH. With a capacity of 0, nothing is cached.
+    OpenFileCache(IoQueue& io, Fd rootDir, size_t capacity = 1024,
+        Clock::duration maxAge = std::chrono::seconds(2));
+
+    // Fails with EISDIR for directories and EACCES for anything else that is not a regular file
+    Task<Result<FilePtr>> get(std::string path);
+
+    void clear();
+
+    size_t size() const { return lru_.size(); }
+    size_t capacity() const { return capacity_; }
+
+private:
+    struct Entry {
+        std::string path;
+        FilePtr file;
+        Clock::time_point openedAt;
+    };
+
+    Task<Result<FilePtr>> open(const std::string& path);
+
+    IoQueue& io_;
+    Fd rootDir_;
+    size_t capacity_;
+    Clock::duration maxAge_;
+    // Most recently used first
+    std::list<Entry> lru_;
+    std::unordered_map<std::string, std::list<Entry>::iterator> entries_;
+};
+
+// Sends files to sockets without copying them through userspace.
+// Files that fit into a chunk of `buffers` together with the header are read into the chunk behind
+// the header and sent in one go (a linked readFixed and sendFixed). Larger files (or all files
+// without `buffers`, or if no chunk is available) are spliced through a pipe from `pipes` in pieces
+// of `chunkSize` (a hard linked pair of splices per piece).
+class FileSender {
+public:
+    FileSender(IoQueue& io, PipePool& pipes, RegisteredBufferPool* buffers = nullptr,
+        size_t chunkSize = 64 * 1024);
+
+    // Sends `header` (e.g. the HTTP response header) followed by the contents of `file`, which must
+    // stay valid until the task completed. The result is the number of bytes sent.
+    // If this fails, the socket is in an undefined state and should be closed.
+    Task<Result<uint64_t>> send(AnyFd socket, const OpenFile& file, std::string_view header = {});
+
+private:
+    Task<Result<uint64_t>> sendBuffered(
+        AnyFd socket, const OpenFile& file, std::string_view header, RegisteredBuffer buffer);
+    Task<Result<uint64_t>> sendSpliced(
+        AnyFd socket, const OpenFile& file, std::string_view header);
+
+    IoQueue& io_;
+    PipePool& pipes_;
+    RegisteredBufferPool* buffers_;
+    size_t chunkSize_;
+};
+}
@@ -21,7 +21,7 @@ public:
         void await_resume() const noexcept { }
     };
 
-    struct Promise {
+    struct Promise : public PooledFrame {
         std::coroutine_handle<> continuation;
         Result result;
 
@@ -106,7 +106,7 @@ private:
 };
 
 template <>
-struct Task<void>::Promise {
+struct Task<void>::Promise : public PooledFrame {
     std::coroutine_handle<> continuation;
 
     Task get_return_object()
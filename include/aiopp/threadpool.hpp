@@ -1,23 +1,39 @@
 #pragma once
 
 #include <atomic>
-#include <condition_variable>
+#include <memory>
 #include <mutex>
 #include <queue>
+#include <semaphore>
 #include <thread>
 #include <vector>
 
+#include "aiopp/boundedqueue.hpp"
 #include "aiopp/function.hpp"
 #include "aiopp/future.hpp"
 #include "aiopp/ioqueue.hpp"
 
 namespace aiopp {
+// Every worker has its own work-stealing deque. Tasks pushed from a worker (e.g. nested tasks) go
+// into that worker's deque and tasks pushed from other threads go into a shared injector queue.
+// Idle workers take from their own deque, then the injector, then steal from other workers and
+// after spinning for a bit without finding work, they park until a new task is pushed.
+// The injector is a bounded lock-free queue. If it is full, tasks go into an overflow queue behind
+// a mutex, which workers drain in batches while it is not empty. This is much slower, so if you
+// push many tasks from outside the pool at once, pass an injector capacity that fits them.
 class ThreadPool {
 public:
-    ThreadPool(size_t numThreads = std::thread::hardware_concurrency());
+    static constexpr size_t DefaultInjectorCapacity = 16384;
+
+    // injectorCapacity will be rounded up to the next power of two (see BoundedQueue)
+    ThreadPool(size_t numThreads = std::thread::hardware_concurrency(),
+        size_t injectorCapacity = DefaultInjectorCapacity);
 
     ~ThreadPool();
 
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
     void push(Function<void()> task);
 
     template <typename Func, typename Result = std::invoke_result_t<Func>>
@@ -36,13 +52,25 @@ public:
     }
 
 private:
-    void workerFunc();
+    // A released Function<void()> (see Function::release)
+    using Job = void;
+    struct Worker;
+
+    void workerFunc(size_t index);
+    Job* findJob(Worker& worker);
+    bool hasJobs() const;
+    void park();
+    void wakeOne();
 
     std::atomic<bool> running_;
-    std::vector<std::thread> threads_;
-    std::condition_variable tasksCv_;
-    std::mutex tasksMutex_;
-    std::queue<Function<void(void)>> tasks_;
+    std::vector<std::unique_ptr<Worker>> workers_;
+    BoundedQueue<Job*> injector_;
+    // If the injector is full, tasks go here
+    std::mutex overflowMutex_;
+    std::queue<Job*> overflow_;
+    std::atomic<size_t> overflowSize_ { 0 };
+    std::atomic<size_t> numParked_ { 0 };
+    std::counting_semaphore<> parkSemaphore_ { 0 };
 };
 
 ThreadPool& getDefaultThreadPool();
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <optional>
+
+#include "aiopp/function.hpp"
+
+namespace aiopp {
+class TimerWheel;
+
+// A timer that can be armed on a TimerWheel (usually with IoQueue::armTimer). Arming, re-arming and
+// canceling are O(1) and don't allocate, so you can keep one per connection and push its deadline
+// back every time something is received.
+// It is canceled when it is destroyed.
+class Timer {
+public:
+    Timer() = default;
+    Timer(Function<void()> callback);
+    virtual ~Timer();
+
+    Timer(const Timer&) = delete;
+    Timer& operator=(const Timer&) = delete;
+
+    void setCallback(Function<void()> callback);
+
+    bool armed() const { return wheel_ != nullptr; }
+
+    void cancel();
+
+protected:
+    // The timer is not armed anymore when this is called, so it may be re-armed here.
+    // The default implementation calls the callback.
+    virtual void expired();
+
+private:
+    friend class TimerWheel;
+
+    Function<void()> callback_;
+    TimerWheel* wheel_ = nullptr;
+    Timer** list_ = nullptr;
+    Timer* prev_ = nullptr;
+    Timer* next_ = nullptr;
+    uint64_t expiry_ = 0;
+    uint8_t level_ = 0;
+};
+
+// A hierarchical timing wheel (Varghese & Lauck). There are 4 levels of 256 slots each, where a
+// slot on level L covers 256^L ticks. Timers are put into the slot of their expiry tick on the
+// lowest level that can represent it and every 256^L ticks the next slot of level L is emptied
+// and its timers are moved to lower levels.
+// This class only does the bookkeeping. Someone has to call advance regularly, which IoQueue does
+// with a single kernel timeout for the next tick returned by getNextTick.
+class TimerWheel {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    TimerWheel(Clock::duration tickDuration = std::chrono::milliseconds(1),
+        Clock::time_point start = Clock::now());
+
+    ~TimerWheel();
+
+    TimerWheel(const TimerWheel&) = delete;
+    TimerWheel& operator=(const TimerWheel&) = delete;
+
+    size_t size() const { return size_; }
+
+    uint64_t getCurrentTick() const { return currentTick_; }
+
+    // The first tick at or after `time`, so timers never expire early.
+    uint64_t getTick(Clock::time_point time) const;
+    Clock::time_point getTime(uint64_t tick) const;
+
+    // If the timer is armed already, it is moved. Returns the tick at which the timer will expire.
+    uint64_t arm(Timer& timer, Clock::time_point deadline);
+
+    void cancel(Timer& timer);
+
+    // Processes all ticks up to `now` and calls expired() on all timers that expired.
+    void advance(Clock::time_point now = Clock::now());
+
+    // Returns the next tick at which advance has to be called (a timer expires or timers have to be
+    // moved to a lower level) or nullopt if no timers are armed. This is O(slots per level).
+    std::optional<uint64_t> getNextTick() const;
+
+private:
+    static constexpr size_t NumLevels = 4;
+    static constexpr size_t LevelBits = 8;
+    static constexpr size_t NumSlots = 1 << LevelBits;
+    static constexpr uint64_t SlotMask = NumSlots - 1;
+    // Marks timers that are in a temporary list, while a slot is being processed
+    static constexpr uint8_t DetachedLevel = NumLevels;
+
+    void insert(Timer& timer);
+    void unlink(Timer& timer);
+    Timer* detachSlot(size_t level, size_t slot);
+    void tick();
+
+    Clock::duration tickDuration_;
+    Clock::time_point start_;
+    uint64_t currentTick_ = 0;
+    size_t size_ = 0;
+    std::array<size_t, NumLevels> levelSizes_ {};
+    std::array<std::array<Timer*, NumSlots>, NumLevels> slots_ {};
+};
+}
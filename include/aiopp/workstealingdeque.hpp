@@ -0,0 +1,135 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace aiopp {
+// Chase-Lev work-stealing deque with the memory orderings from "Correct and Efficient
+// Work-Stealing for Weak Memory Models" (Lê et al., 2013).
+// The owner thread pushes and pops at the bottom (LIFO, which is good for locality), other threads
+// steal from the top (FIFO). Only push and pop may be called by the owner and steal from anywhere.
+// This only stores pointers, because the elements have to be copied atomically.
+template <typename T>
+class WorkStealingDeque {
+public:
+    WorkStealingDeque(size_t initialCapacity = 256)
+    {
+        auto array = std::make_unique<Array>(std::bit_ceil(std::max(initialCapacity, size_t(2))));
+        array_.store(array.get(), std::memory_order_relaxed);
+        arrays_.push_back(std::move(array));
+    }
+
+    WorkStealingDeque(const WorkStealingDeque&) = delete;
+    WorkStealingDeque& operator=(const WorkStealingDeque&) = delete;
+
+    // This is only a hint, because it might change at any moment
+    bool empty() const
+    {
+        const auto b = bottom_.load(std::memory_order_relaxed);
+        const auto t = top_.load(std::memory_order_relaxed);
+        return b <= t;
+    }
+
+    void push(T* value)
+    {
+        const auto b = bottom_.load(std::memory_order_relaxed);
+        const auto t = top_.load(std::memory_order_acquire);
+        auto array = array_.load(std::memory_order_relaxed);
+        if (b - t > static_cast<int64_t>(array->capacity) - 1) {
+            array = grow(array, t, b);
+        }
+        array->put(b, value);
+        std::atomic_thread_fence(std::memory_order_release);
+        bottom_.store(b + 1, std::memory_order_relaxed);
+    }
+
+    T* pop()
+    {
+        const auto b = bottom_.load(std::memory_order_relaxed) - 1;
+        const auto array = array_.load(std::memory_order_relaxed);
+        bottom_.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        auto t = top_.load(std::memory_order_relaxed);
+        if (t > b) {
+            // Empty
+            bottom_.store(b + 1, std::memory_order_relaxed);
+            return nullptr;
+        }
+
+        auto value = array->get(b);
+        if (t == b) {
+            // This is the last element, so we race with stealers for it
+            if (!top_.compare_exchange_strong(
+                    t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+                value = nullptr;
+            }
+            bottom_.store(b + 1, std::memory_order_relaxed);
+        }
+        return value;
+    }
+
+    // Returns nullptr if the deque is empty or if another thread stole the element first.
+    T* steal()
+    {
+        auto t = top_.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        const auto b = bottom_.load(std::memory_order_acquire);
+        if (t >= b) {
+            return nullptr;
+        }
+        const auto array = array_.load(std::memory_order_acquire);
+        auto value = array->get(t);
+        if (!top_.compare_exchange_strong(
+                t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+            return nullptr;
+        }
+        return value;
+    }
+
+private:
+    struct Array {
+        size_t capacity;
+        std::unique_ptr<std::atomic<T*>[]> elements;
+
+        Array(size_t capacity)
+            : capacity(capacity)
+            , elements(new std::atomic<T*>[capacity])
+        {
+        }
+
+        T* get(int64_t i) const
+        {
+            return elements[static_cast<size_t>(i) & (capacity - 1)].load(
+                std::memory_order_relaxed);
+        }
+
+        void put(int64_t i, T* value)
+        {
+            elements[static_cast<size_t>(i) & (capacity - 1)].store(
+                value, std::memory_order_relaxed);
+        }
+    };
+
+    Array* grow(Array* array, int64_t t, int64_t b)
+    {
+        auto newArray = std::make_unique<Array>(array->capacity * 2);
+        for (auto i = t; i < b; ++i) {
+            newArray->put(i, array->get(i));
+        }
+        auto ptr = newArray.get();
+        // Stealers might still read from the old array, so it is only freed with the deque.
+        arrays_.push_back(std::move(newArray));
+        array_.store(ptr, std::memory_order_release);
+        return ptr;
+    }
+
+    alignas(64) std::atomic<int64_t> top_ { 0 };
+    alignas(64) std::atomic<int64_t> bottom_ { 0 };
+    std::atomic<Array*> array_;
+    std::vector<std::unique_ptr<Array>> arrays_; // only touched by the owner
+};
+}
@@ -0,0 +1,118 @@
+#include "aiopp/asyncfile.hpp"
+
+#include <cassert>
+
+namespace aiopp {
+Task<Result<AsyncFile>> AsyncFile::open(IoQueue& io, const char* path, int flags, mode_t mode)
+{
+    return openAt(io, AT_FDCWD, path, flags, mode);
+}
+
+Task<Result<AsyncFile>> AsyncFile::openAt(
+    IoQueue& io, int dirfd, const char* path, int flags, mode_t mode)
+{
+    const auto res = co_await io.openat(dirfd, path, flags, mode);
+    if (!res) {
+        co_return error(res.error());
+    }
+    co_return AsyncFile(io, Fd(*res));
+}
+
+AsyncFile::AsyncFile(IoQueue& io, Fd fd)
+    : io_(&io)
+    , fd_(std::move(fd))
+{
+}
+
+Fd AsyncFile::release()
+{
+    return Fd(fd_.release());
+}
+
+AsyncFile::OperationHandle AsyncFile::read(void* buf, size_t count, uint64_t offset)
+{
+    assert(io_ && fd_ != -1);
+    return io_->read(fd_, buf, count, offset);
+}
+
+AsyncFile::OperationHandle AsyncFile::write(const void* buf, size_t count, uint64_t offset)
+{
+    assert(io_ && fd_ != -1);
+    return io_->write(fd_, buf, count, offset);
+}
+
+AsyncFile::OperationHandle AsyncFile::readv(const ::iovec* iov, int iovcnt, uint64_t offset)
+{
+    assert(io_ && fd_ != -1);
+    return io_->readv(fd_, iov, iovcnt, offset);
+}
+
+AsyncFile::OperationHandle AsyncFile::writev(const ::iovec* iov, int iovcnt, uint64_t offset)
+{
+    assert(io_ && fd_ != -1);
+    return io_->writev(fd_, iov, iovcnt, offset);
+}
+
+Task<Result<size_t>> AsyncFile::readAll(void* buf, size_t count, uint64_t offset)
+{
+    size_t total = 0;
+    while (total < count) {
+        const auto res
+            = co_await read(static_cast<char*>(buf) + total, count - total, offset + total);
+        if (!res) {
+            co_return error(res.error());
+        }
+        if (*res == 0) { // EOF
+            break;
+        }
+        total += static_cast<size_t>(*res);
+    }
+    co_return total;
+}
+
+Task<Result<size_t>> AsyncFile::writeAll(const void* buf, size_t count, uint64_t offset)
+{
+    size_t total = 0;
+    while (total < count) {
+        const auto res
+            = co_await write(static_cast<const char*>(buf) + total, count - total, offset + total);
+        if (!res) {
+            co_return error(res.error());
+        }
+        if (*res == 0) {
+            co_return error(std::make_error_code(std::errc::io_error));
+        }
+        total += static_cast<size_t>(*res);
+    }
+    co_return total;
+}
+
+AsyncFile::OperationHandle AsyncFile::fsync()
+{
+    assert(io_ && fd_ != -1);
+    return io_->fsync(fd_);
+}
+
+AsyncFile::OperationHandle AsyncFile::fdatasync()
+{
+    assert(io_ && fd_ != -1);
+    return io_->fdatasync(fd_);
+}
+
+Task<Result<struct ::statx>> AsyncFile::stat(unsigned int mask)
+{
+    assert(io_ && fd_ != -1);
+    struct ::statx buf;
+    const auto res = co_await io_->statx(fd_, "", AT_EMPTY_PATH, mask, &buf);
+    if (!res) {
+        co_return error(res.error());
+    }
+    co_return buf;
+}
+
+AsyncFile::OperationHandle AsyncFile::close()
+{
+    assert(io_ && fd_ != -1);
+    return io_->close(fd_.release());
+}
+}
@@ -0,0 +1,186 @@
+#include "aiopp/bufferring.hpp"
+
+#include <bit>
+#include <cassert>
+#include <limits>
+#include <utility>
+
+#include <sys/mman.h>
+
+#include "aiopp/ioqueue_impl_iouring.hpp"
+#include "aiopp/log.hpp"
+#include "aiopp/util.hpp"
+
+namespace aiopp {
+ProvidedBuffer::ProvidedBuffer(BufferRing* ring, uint16_t id, std::byte* data, size_t size)
+    : ring_(ring)
+    , id_(id)
+    , data_(data)
+    , size_(size)
+{
+}
+
+ProvidedBuffer::ProvidedBuffer(ProvidedBuffer&& other)
+    : ring_(std::exchange(other.ring_, nullptr))
+    , id_(other.id_)
+    , data_(std::exchange(other.data_, nullptr))
+    , size_(std::exchange(other.size_, 0))
+{
+}
+
+ProvidedBuffer::~ProvidedBuffer()
+{
+    release();
+}
+
+ProvidedBuffer& ProvidedBuffer::operator=(ProvidedBuffer&& other)
+{
+    release();
+    ring_ = std::exchange(other.ring_, nullptr);
+    id_ = other.id_;
+    data_ = std::exchange(other.data_, nullptr);
+    size_ = std::exchange(other.size_, 0);
+    return *this;
+}
+
+void ProvidedBuffer::release()
+{
+    if (ring_) {
+        ring_->release(id_);
+    }
+    ring_ = nullptr;
+    data_ = nullptr;
+    size_ = 0;
+}
+
+BufferRing::BufferRing(IoQueue& io, size_t numBuffers, size_t bufferSize)
+    : io_(io)
+    , numBuffers_(numBuffers)
+    , bufferSize_(bufferSize)
+    , groupId_(io.impl_->nextBufferGroupId_++)
+{
+    assert(std::has_single_bit(numBuffers) && numBuffers <= 32768);
+    assert(bufferSize > 0 && bufferSize <= std::numeric_limits<uint32_t>::max());
+
+    // mmap gives us page-aligned memory, that is not touched until a buffer is actually used
+    auto mem = ::mmap(nullptr, numBuffers_ * bufferSize_, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) {
+        getLogger().log(
+            LogSeverity::Error, "Could not allocate buffer ring memory: " + errnoToString(errno));
+        return;
+    }
+    memory_ = static_cast<std::byte*>(mem);
+
+    bufRing_ = io_.impl_->ring_.setupBufferRing(numBuffers_, groupId_);
+    if (!bufRing_) {
+        getLogger().log(
+            LogSeverity::Error, "Could not register buffer ring: " + errnoToString(errno));
+        return;
+    }
+
+    const auto mask = io_uring_buf_ring_mask(numBuffers_);
+    for (size_t i = 0; i < numBuffers_; ++i) {
+        const auto id = static_cast<uint16_t>(i);
+        io_uring_buf_ring_add(bufRing_, getBufferData(id), bufferSize_, id, mask, i);
+    }
+    io_uring_buf_ring_advance(bufRing_, numBuffers_);
+}
+
+BufferRing::~BufferRing()
+{
+    if (bufRing_) {
+        io_.impl_->ring_.freeBufferRing(bufRing_, numBuffers_, groupId_);
+    }
+    if (memory_) {
+        ::munmap(memory_, numBuffers_ * bufferSize_);
+    }
+}
+
+ProvidedBuffer BufferRing::getBuffer(uint32_t completionFlags, size_t size)
+{
+    if (!(completionFlags & IORING_CQE_F_BUFFER)) {
+        return ProvidedBuffer {};
+    }
+    const auto id = static_cast<uint16_t>(completionFlags >> IORING_CQE_BUFFER_SHIFT);
+    assert(id < numBuffers_ && size <= bufferSize_);
+    return ProvidedBuffer(this, id, getBufferData(id), size);
+}
+
+void BufferRing::release(uint16_t bufferId)
+{
+    assert(bufRing_ && bufferId < numBuffers_);
+    io_uring_buf_ring_add(bufRing_, getBufferData(bufferId), bufferSize_, bufferId,
+        io_uring_buf_ring_mask(numBuffers_), 0);
+    io_uring_buf_ring_advance(bufRing_, 1);
+}
+
+void BufferRing::complete(IoResult, uint32_t flags)
+{
+    if (flags & IORING_CQE_F_BUFFER) {
+        release(static_cast<uint16_t>(flags >> IORING_CQE_BUFFER_SHIFT));
+    }
+}
+
+std::byte* BufferRing::getBufferData(uint16_t bufferId) const
+{
+    return memory_ + bufferId * bufferSize_;
+}
+
+IoQueue::ProvidedBufferAwaiter::~ProvidedBufferAwaiter()
+{
+    if (operation) {
+        // If the kernel has picked a buffer already, the BufferRing will release it
+        operation.setCompleter(buffers);
+        operation.cancel(false);
+        operation = {};
+    }
+}
+
+Result<ProvidedBuffer> IoQueue::ProvidedBufferAwaiter::await_resume() noexcept
+{
+    if (!result) {
+        return error(result.error());
+    }
+    return buffers->getBuffer(flags, *result);
+}
+
+IoQueue::RecvStream::RecvStream(IoQueue& io, AnyFd fd, BufferRing& buffers)
+    : MultishotStream(io)
+    , fd_(fd)
+    , buffers_(&buffers)
+{
+}
+
+IoQueue::RecvStream::~RecvStream()
+{
+    // Buffers of queued completions are released when the ProvidedBuffers are destroyed
+    for (const auto& completion : completions_) {
+        if (completion.result) {
+            buffers_->getBuffer(completion.flags, *completion.result);
+        }
+    }
+    if (operation_) {
+        // Same as in ~ProvidedBufferAwaiter
+        operation_.setCompleter(buffers_);
+        operation_.cancel(false);
+        operation_ = {};
+    }
+}
+
+OperationHandle IoQueue::RecvStream::arm()
+{
+    return io_.impl_->recvMultishot(fd_, buffers_->getGroupId());
+}
+
+Result<ProvidedBuffer> IoQueue::RecvStream::convert(Completion completion)
+{
+    if (!completion.result) {
+        return error(completion.result.error());
+    }
+    if (*completion.result == 0) {
+        finished_ = true;
+    }
+    return buffers_->getBuffer(completion.flags, *completion.result);
+}
+}
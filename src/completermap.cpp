@@ -1,93 +1,121 @@
 #include "aiopp/completermap.hpp"
 
+#include <algorithm>
+#include <bit>
 #include <cstdlib>
+#include <utility>
 
 namespace aiopp {
-void* CompleterMap::Empty = nullptr;
-void* CompleterMap::Tombstone = reinterpret_cast<void*>(std::numeric_limits<uintptr_t>::max());
+namespace {
+    uint64_t makeKey(uint32_t index, uint32_t generation)
+    {
+        return (static_cast<uint64_t>(generation) << 32) | index;
+    }
+
+    uint32_t getIndex(uint64_t key)
+    {
+        return static_cast<uint32_t>(key & 0xffff'ffff);
+    }
+
+    uint32_t getGeneration(uint64_t key)
+    {
+        return static_cast<uint32_t>(key >> 32);
+    }
+}
 
 CompleterMap::CompleterMap(size_t numEntries)
-    : entries_(getNextSize(numEntries))
 {
+    grow(getNextSize(numEntries));
 }
 
-namespace {
-    // SplitMix64: https://nullprogram.com/blog/2018/07/31/
-    static uint64_t hash(uint64_t x)
-    {
-        x ^= x >> 30;
-        x *= 0xbf58476d1ce4e5b9U;
-        x ^= x >> 27;
-        x *= 0x94d049bb133111ebU;
-        x ^= x >> 31;
-        return x;
+uint64_t CompleterMap::insert(void* value)
+{
+    if (freeListHead_ == InvalidIndex) {
+        grow(slots_.size() * 2);
     }
+    const auto index = freeListHead_;
+    auto& slot = slots_[index];
+    freeListHead_ = slot.nextFree;
+    slot.nextFree = InvalidIndex;
+    slot.value = value;
+    size_++;
+    return makeKey(index, slot.generation);
 }
 
-void CompleterMap::insert(uint64_t key, void* value)
+bool CompleterMap::set(uint64_t key, void* value)
 {
-    assert(size() < capacity());
-    const auto h = (hash(key) % (entries_.size() - 1)) + 1;
-    for (size_t i = 0; i < entries_.size(); ++i) {
-        auto& entry = entries_[(key + i * h) % entries_.size()];
-        if (entry.value == Empty || entry.value == Tombstone) {
-            entry.key = key;
-            entry.value = value;
-            size_++;
-            return;
-        }
+    const auto slot = lookup(key);
+    if (!slot) {
+        return false;
     }
-    std::abort();
+    slot->value = value;
+    return true;
 }
 
 void* CompleterMap::get(uint64_t key) const
 {
-    const auto idx = lookup(key);
-    if (!idx) {
+    const auto slot = lookup(key);
+    if (!slot) {
         return nullptr;
     }
-    return entries_[*idx].value;
+    return slot->value;
 }
 
 void* CompleterMap::remove(uint64_t key)
 {
-    const auto idx = lookup(key);
-    if (!idx) {
+    const auto slot = lookup(key);
+    if (!slot) {
         return nullptr;
     }
-    const auto value = entries_[*idx].value;
-    entries_[*idx].value = Tombstone;
+    const auto value = slot->value;
+    slot->value = nullptr;
+    // Invalidate all keys that refer to this slot
+    slot->generation = (slot->generation + 1) & GenerationMask;
+    slot->nextFree = freeListHead_;
+    freeListHead_ = getIndex(key);
     size_--;
     return value;
 }
 
 size_t CompleterMap::getNextSize(size_t num)
 {
-    // https://www.planetmath.org/goodhashtableprimes
-    static constexpr auto primes = std::to_array<size_t>(
-        { 53, 97, 193, 389, 769, 1543, 3079, 6151, 12289, 24593, 49157, 98317, 196613 });
-    assert(num <= primes.back());
-    for (const auto prime : primes) {
-        if (num < prime) {
-            return prime;
-        }
+    return std::bit_ceil(std::max(num, size_t(1)));
+}
+
+const CompleterMap::Slot* CompleterMap::lookup(uint64_t key) const
+{
+    const auto index = getIndex(key);
+    if (index >= slots_.size()) {
+        return nullptr;
     }
-    assert(false && "Completer map size too large");
-    std::abort();
+    const auto& slot = slots_[index];
+    // A free slot has never handed out a key with its current generation, so if the generations
+    // match, the slot must be occupied.
+    if (slot.generation != getGeneration(key)) {
+        return nullptr;
+    }
+    return &slot;
 }
 
-std::optional<size_t> CompleterMap::lookup(uint64_t key) const
+CompleterMap::Slot* CompleterMap::lookup(uint64_t key)
 {
-    const auto h = (hash(key) % (entries_.size() - 1)) + 1;
-    for (size_t i = 0; i < entries_.size(); ++i) {
-        const auto idx = (key + i * h) % entries_.size();
-        auto& entry = entries_[idx];
-        if (entry.value == Empty) {
-            return std::nullopt;
-        } else if (entry.value != Tombstone && entry.key == key) {
-            return idx;
-        }
+    return const_cast<Slot*>(std::as_const(*this).lookup(key));
+}
+
+void CompleterMap::grow(size_t newSize)
+{
+    // The two largest indices are reserved, so that no key will ever be equal to
+    // IoQueue::OpIdInvalid or IoQueue::OpIdIgnore.
+    if (newSize >= InvalidIndex - 1) {
+        assert(false && "Completer map size too large");
+        std::abort();
+    }
+    const auto oldSize = slots_.size();
+    slots_.resize(newSize);
+    // Push the new slots in reverse order, so lower indices are used first
+    for (size_t i = newSize; i > oldSize; --i) {
+        slots_[i - 1].nextFree = freeListHead_;
+        freeListHead_ = static_cast<uint32_t>(i - 1);
     }
-    return std::nullopt;
 }
 }
@@ -0,0 +1,180 @@
+#include "aiopp/distributor.hpp"
+
+#include <cassert>
+#include <limits>
+
+#include <unistd.h>
+
+#include "aiopp/log.hpp"
+
+namespace aiopp {
+ConnectionDistributor::Policy ConnectionDistributor::roundRobin()
+{
+    return [next = size_t(0)](const std::vector<IoQueue*>& workers) mutable {
+        return next++ % workers.size();
+    };
+}
+
+ConnectionDistributor::Policy ConnectionDistributor::leastInFlight()
+{
+    // The numbers are only updated once per batch, so if many connections come in at once, they
+    // would all go to the same worker. Starting the search somewhere else every time spreads ties.
+    return [start = size_t(0)](const std::vector<IoQueue*>& workers) mutable {
+        size_t best = 0;
+        size_t bestNum = std::numeric_limits<size_t>::max();
+        for (size_t i = 0; i < workers.size(); ++i) {
+            const auto idx = (start + i) % workers.size();
+            const auto num = workers[idx]->getNumOperationsInFlight();
+            if (num < bestNum) {
+                best = idx;
+                bestNum = num;
+            }
+        }
+        start++;
+        return best;
+    };
+}
+
+ConnectionDistributor::ConnectionDistributor(IoQueue& acceptor, std::vector<IoQueue*> workers,
+    Handler handler, bool useDirectDescriptors, Policy policy)
+    : acceptor_(acceptor)
+    , workers_(std::move(workers))
+    , handler_(std::move(handler))
+    , useDirectDescriptors_(useDirectDescriptors)
+    , policy_(std::move(policy))
+{
+    assert(!workers_.empty());
+    for (auto worker : workers_) {
+        auto inbox = std::make_unique<WorkerInbox>();
+        inbox->distributor = this;
+        inbox->io = worker;
+        inboxes_.push_back(std::move(inbox));
+    }
+}
+
+void ConnectionDistributor::start(AnyFd listenSocket)
+{
+    stopRequested_ = false;
+    if (useDirectDescriptors_) {
+        acceptDirectLoop(listenSocket);
+    } else {
+        acceptLoop(listenSocket);
+    }
+}
+
+void ConnectionDistributor::stop()
+{
+    stopRequested_ = true;
+    if (accept_) {
+        accept_->cancel();
+    }
+}
+
+void ConnectionDistributor::WorkerInbox::complete(IoResult result, uint32_t)
+{
+    // postDirectFd only completes this if the descriptor has been installed
+    assert(result);
+    distributor->handler_(*io, AnyFd::fromIndex(*result));
+}
+
+void ConnectionDistributor::Handoff::complete(IoResult result, uint32_t)
+{
+    if (result) {
+        distributor->handler_(*io, AnyFd(fd));
+    } else {
+        // This is called on the acceptor thread
+        getLogger().log(LogSeverity::Error,
+            "Could not hand connection to worker: " + result.error().message());
+        ::close(fd);
+    }
+    delete this;
+}
+
+void ConnectionDistributor::DirectHandoff::complete(IoResult result, uint32_t)
+{
+    if (!result) {
+        getLogger().log(LogSeverity::Error,
+            "Could not send connection to worker: " + result.error().message());
+    }
+    // If it succeeded, the worker has its own reference to the socket now
+    acceptor->close(AnyFd::fromIndex(index));
+    delete this;
+}
+
+void ConnectionDistributor::handOff(int fd)
+{
+    const auto workerIdx = policy_(workers_);
+    assert(workerIdx < workers_.size());
+    auto handoff = new Handoff;
+    handoff->distributor = this;
+    handoff->io = workers_[workerIdx];
+    handoff->fd = fd;
+    if (!acceptor_.post(*handoff->io, *handoff, fd)) {
+        ::close(fd);
+        delete handoff;
+    }
+}
+
+void ConnectionDistributor::handOffDirect(int index)
+{
+    const auto workerIdx = policy_(workers_);
+    assert(workerIdx < inboxes_.size());
+    auto& inbox = *inboxes_[workerIdx];
+    const auto send = acceptor_.postDirectFd(*inbox.io, AnyFd::fromIndex(index), inbox);
+    if (!send) {
+        acceptor_.close(AnyFd::fromIndex(index));
+        return;
+    }
+    auto handoff = new DirectHandoff;
+    handoff->acceptor = &acceptor_;
+    handoff->index = index;
+    send.setCompleter(handoff);
+}
+
+bool ConnectionDistributor::handleAcceptError(const std::error_code& ec)
+{
+    if (ec == std::errc::device_or_resource_busy) {
+        // The SQ is full, so the stream could not be armed and would fail again right away
+        getLogger().log(LogSeverity::Error, "Could not start accept in ConnectionDistributor");
+        return false;
+    }
+    if (ec != std::errc::operation_canceled) {
+        getLogger().log(LogSeverity::Error, "Error in accept: " + ec.message());
+    }
+    return true;
+}
+
+BasicCoroutine ConnectionDistributor::acceptLoop(AnyFd listenSocket)
+{
+    auto connections = acceptor_.acceptMultishot(listenSocket);
+    accept_ = &connections;
+    while (!stopRequested_) {
+        auto conn = co_await connections.next();
+        if (!conn) {
+            if (!handleAcceptError(conn.error())) {
+                break;
+            }
+            continue;
+        }
+        handOff(conn->fd.release());
+    }
+    accept_ = nullptr;
+}
+
+BasicCoroutine ConnectionDistributor::acceptDirectLoop(AnyFd listenSocket)
+{
+    auto connections = acceptor_.acceptMultishotDirect(listenSocket);
+    accept_ = &connections;
+    while (!stopRequested_) {
+        auto fd = co_await connections.next();
+        if (!fd) {
+            if (!handleAcceptError(fd.error())) {
+                break;
+            }
+            continue;
+        }
+        handOffDirect(fd->release().fd);
+    }
+    accept_ = nullptr;
+}
+}
@@ -2,6 +2,9 @@
 
 #include <cassert>
 #include <unistd.h>
+#include <utility>
+
+#include "aiopp/ioqueue.hpp"
 
 namespace aiopp {
 Fd::Fd()
@@ -55,14 +58,68 @@ int Fd::release()
     return fd;
 }
 
+DirectFd::DirectFd()
+    : io_(nullptr)
+    , index_(-1)
+{
+}
+
+DirectFd::DirectFd(IoQueue& io, int index)
+    : io_(&io)
+    , index_(index)
+{
+}
+
+DirectFd::DirectFd(DirectFd&& other)
+    : io_(other.io_)
+    , index_(other.release().fd)
+{
+}
+
+DirectFd::~DirectFd()
+{
+    close();
+}
+
+DirectFd& DirectFd::operator=(DirectFd&& other)
+{
+    close();
+    io_ = other.io_;
+    index_ = other.release().fd;
+    return *this;
+}
+
+void DirectFd::close()
+{
+    if (index_ != -1) {
+        // Nobody is interested in the result
+        io_->close(AnyFd::fromIndex(index_));
+    }
+    index_ = -1;
+}
+
+AnyFd DirectFd::release()
+{
+    const auto fd = AnyFd::fromIndex(index_);
+    index_ = -1;
+    return fd;
+}
+
 Pipe::Pipe()
 {
     int fds[2];
-    assert(pipe(fds) != -1);
+    [[maybe_unused]] const auto res = pipe(fds);
+    assert(res != -1);
     read.reset(fds[0]);
     write.reset(fds[1]);
 }
 
+Pipe::Pipe(Fd read, Fd write)
+    : read(std::move(read))
+    , write(std::move(write))
+{
+}
+
 void Pipe::close()
 {
     read.close();
@@ -0,0 +1,103 @@
+#include "aiopp/framepool.hpp"
+
+#include <array>
+#include <new>
+
+namespace aiopp {
+namespace {
+    constexpr size_t Granularity = 64;
+    constexpr size_t NumSizeClasses = 16; // up to 1024 bytes
+    constexpr size_t MaxFramesPerClass = 256;
+
+    struct FreeFrame {
+        FreeFrame* next;
+    };
+
+    struct FreeList {
+        FreeFrame* head = nullptr;
+        size_t size = 0;
+    };
+
+    size_t getSizeClass(size_t size)
+    {
+        return (size + Granularity - 1) / Granularity - 1;
+    }
+
+    struct Pool {
+        std::array<FreeList, NumSizeClasses> freeLists;
+        FramePoolStats stats;
+
+        ~Pool() { trim(); }
+
+        void trim()
+        {
+            for (size_t i = 0; i < freeLists.size(); ++i) {
+                auto& list = freeLists[i];
+                while (list.head) {
+                    auto next = list.head->next;
+                    ::operator delete(list.head);
+                    list.head = next;
+                }
+                list.size = 0;
+            }
+            stats.bytesHeld = 0;
+        }
+    };
+
+    Pool& getPool()
+    {
+        thread_local Pool pool;
+        return pool;
+    }
+}
+
+void* allocateFrame(size_t size)
+{
+    auto& pool = getPool();
+    const auto sizeClass = getSizeClass(size);
+    if (sizeClass >= NumSizeClasses) {
+        pool.stats.misses++;
+        return ::operator new(size);
+    }
+
+    auto& list = pool.freeLists[sizeClass];
+    if (list.head) {
+        auto frame = list.head;
+        list.head = frame->next;
+        list.size--;
+        pool.stats.hits++;
+        pool.stats.bytesHeld -= (sizeClass + 1) * Granularity;
+        return frame;
+    }
+    pool.stats.misses++;
+    // Allocate the full size class, so the frame can be reused for any size in this class
+    return ::operator new((sizeClass + 1) * Granularity);
+}
+
+void deallocateFrame(void* ptr, size_t size)
+{
+    auto& pool = getPool();
+    const auto sizeClass = getSizeClass(size);
+    if (sizeClass >= NumSizeClasses || pool.freeLists[sizeClass].size >= MaxFramesPerClass) {
+        ::operator delete(ptr);
+        return;
+    }
+
+    auto& list = pool.freeLists[sizeClass];
+    auto frame = static_cast<FreeFrame*>(ptr);
+    frame->next = list.head;
+    list.head = frame;
+    list.size++;
+    pool.stats.bytesHeld += (sizeClass + 1) * Granularity;
+}
+
+FramePoolStats getFramePoolStats()
+{
+    return getPool().stats;
+}
+
+void trimFramePool()
+{
+    getPool().trim();
+}
+}
@@ -6,7 +6,9 @@
 #include <sys/eventfd.h>
 #include <unistd.h>
 
+#include "aiopp/bufferring.hpp"
 #include "aiopp/log.hpp"
+#include "aiopp/registeredbufferpool.hpp"
 #include "aiopp/util.hpp"
 
 #ifdef AIOPP_IOQUEUE_BACKEND_IOURING
@@ -14,10 +16,24 @@
 #endif
 
 namespace aiopp {
+namespace {
+    IoQueue::Options getDefaultOptions(size_t size)
+    {
+        IoQueue::Options options;
+        options.size = size;
+        return options;
+    }
+}
+
 IoQueue::IoQueue(size_t size)
-    : impl_(std::make_unique<IoQueueImpl>(this, size))
+    : IoQueue(getDefaultOptions(size))
 {
-    if (!impl_->init()) {
+}
+
+IoQueue::IoQueue(const Options& options)
+    : impl_(std::make_unique<IoQueueImpl>(this, options.size))
+{
+    if (!impl_->init(options)) {
         // Should have logged in init()
         std::exit(1);
     }
@@ -35,22 +51,42 @@ size_t IoQueue::getCapacity() const
     return impl_->getCapacity();
 }
 
-IoQueue::OperationHandle IoQueue::accept(int fd, ::sockaddr_in* addr, socklen_t* addrlen)
+bool IoQueue::registerFileTable(size_t size)
+{
+    return impl_->registerFileTable(size);
+}
+
+IoQueue::OperationHandle IoQueue::accept(AnyFd fd, ::sockaddr_in* addr, socklen_t* addrlen)
 {
     return impl_->accept(fd, addr, addrlen);
 }
 
-IoQueue::OperationHandle IoQueue::connect(int sockfd, const ::sockaddr* addr, socklen_t addrlen)
+IoQueue::OperationHandle IoQueue::acceptDirect(AnyFd fd, ::sockaddr_in* addr, socklen_t* addrlen)
+{
+    return impl_->acceptDirect(fd, addr, addrlen);
+}
+
+IoQueue::AcceptStream IoQueue::acceptMultishot(AnyFd fd)
+{
+    return AcceptStream(*this, fd);
+}
+
+IoQueue::DirectAcceptStream IoQueue::acceptMultishotDirect(AnyFd fd)
+{
+    return DirectAcceptStream(*this, fd);
+}
+
+IoQueue::OperationHandle IoQueue::connect(AnyFd sockfd, const ::sockaddr* addr, socklen_t addrlen)
 {
     return impl_->connect(sockfd, addr, addrlen);
 }
 
-IoQueue::OperationHandle IoQueue::connect(int sockfd, const ::sockaddr_in* addr)
+IoQueue::OperationHandle IoQueue::connect(AnyFd sockfd, const ::sockaddr_in* addr)
 {
     return connect(sockfd, reinterpret_cast<const sockaddr*>(addr), sizeof(::sockaddr_in));
 }
 
-Task<IoResult> IoQueue::connect(int sockfd, IpAddressPort addr)
+Task<IoResult> IoQueue::connect(AnyFd sockfd, IpAddressPort addr)
 {
     ::sockaddr_in sa;
     std::memset(&sa, 0, sizeof(sa));
@@ -60,46 +96,163 @@ Task<IoResult> IoQueue::connect(int sockfd, IpAddressPort addr)
     co_return co_await connect(sockfd, &sa);
 }
 
-IoQueue::OperationHandle IoQueue::send(int sockfd, const void* buf, size_t len)
+IoQueue::OperationHandle IoQueue::send(AnyFd sockfd, const void* buf, size_t len)
 {
     return impl_->send(sockfd, buf, len);
 }
 
-IoQueue::OperationHandle IoQueue::recv(int sockfd, void* buf, size_t len)
+IoQueue::ZeroCopySend IoQueue::sendZc(AnyFd sockfd, const void* buf, size_t len)
+{
+    return ZeroCopySend(impl_->sendZc(sockfd, buf, len));
+}
+
+IoQueue::OperationHandle IoQueue::recv(AnyFd sockfd, void* buf, size_t len)
 {
     return impl_->recv(sockfd, buf, len);
 }
 
-IoQueue::OperationHandle IoQueue::read(int fd, void* buf, size_t count)
+IoQueue::ProvidedBufferAwaiter IoQueue::recv(AnyFd sockfd, BufferRing& buffers)
+{
+    return ProvidedBufferAwaiter(impl_->recv(sockfd, buffers.getGroupId()), &buffers);
+}
+
+IoQueue::RecvStream IoQueue::recvMultishot(AnyFd sockfd, BufferRing& buffers)
+{
+    return RecvStream(*this, sockfd, buffers);
+}
+
+IoQueue::OperationHandle IoQueue::read(AnyFd fd, void* buf, size_t count, uint64_t offset)
+{
+    return impl_->read(fd, buf, count, offset);
+}
+
+IoQueue::OperationHandle IoQueue::write(AnyFd fd, const void* buf, size_t count, uint64_t offset)
+{
+    return impl_->write(fd, buf, count, offset);
+}
+
+IoQueue::OperationHandle IoQueue::readv(AnyFd fd, const ::iovec* iov, int iovcnt, uint64_t offset)
+{
+    return impl_->readv(fd, iov, iovcnt, offset);
+}
+
+IoQueue::OperationHandle IoQueue::writev(
+    AnyFd fd, const ::iovec* iov, int iovcnt, uint64_t offset)
+{
+    return impl_->writev(fd, iov, iovcnt, offset);
+}
+
+IoQueue::OperationHandle IoQueue::fsync(AnyFd fd)
+{
+    return impl_->fsync(fd, 0);
+}
+
+IoQueue::OperationHandle IoQueue::fdatasync(AnyFd fd)
+{
+    return impl_->fsync(fd, IORING_FSYNC_DATASYNC);
+}
+
+IoQueue::OperationHandle IoQueue::readFixed(
+    AnyFd fd, RegisteredBuffer& buf, size_t count, uint64_t offset)
+{
+    assert(buf && count <= buf.size());
+    return impl_->readFixed(fd, buf.data(), count, buf.index(), offset);
+}
+
+IoQueue::OperationHandle IoQueue::readFixed(
+    AnyFd fd, RegisteredBuffer& buf, size_t bufOffset, size_t count, uint64_t offset)
 {
-    return impl_->read(fd, buf, count);
+    assert(buf && bufOffset + count <= buf.size());
+    return impl_->readFixed(fd, buf.data() + bufOffset, count, buf.index(), offset);
 }
 
-IoQueue::OperationHandle IoQueue::close(int fd)
+IoQueue::OperationHandle IoQueue::writeFixed(
+    AnyFd fd, const RegisteredBuffer& buf, size_t count, uint64_t offset)
+{
+    assert(buf && count <= buf.size());
+    return impl_->writeFixed(fd, buf.data(), count, buf.index(), offset);
+}
+
+IoQueue::OperationHandle IoQueue::sendFixed(AnyFd sockfd, const RegisteredBuffer& buf, size_t len)
+{
+    assert(buf && len <= buf.size());
+    return impl_->sendFixed(sockfd, buf.data(), len, buf.index());
+}
+
+IoQueue::OperationHandle IoQueue::close(AnyFd fd)
 {
     return impl_->close(fd);
 }
 
-IoQueue::OperationHandle IoQueue::shutdown(int fd, int how)
+IoQueue::OperationHandle IoQueue::openat(int dirfd, const char* pathname, int flags, mode_t mode)
+{
+    return impl_->openat(dirfd, pathname, flags, mode);
+}
+
+IoQueue::OperationHandle IoQueue::openat2(int dirfd, const char* pathname, const ::open_how* how)
+{
+    return impl_->openat2(dirfd, pathname, how);
+}
+
+IoQueue::OperationHandle IoQueue::statx(
+    int dirfd, const char* pathname, int flags, unsigned int mask, struct ::statx* statxbuf)
+{
+    return impl_->statx(dirfd, pathname, flags, mask, statxbuf);
+}
+
+IoQueue::OperationHandle IoQueue::renameat(
+    int olddirfd, const char* oldpath, int newdirfd, const char* newpath, int flags)
+{
+    return impl_->renameat(olddirfd, oldpath, newdirfd, newpath, flags);
+}
+
+IoQueue::OperationHandle IoQueue::unlinkat(int dirfd, const char* pathname, int flags)
+{
+    return impl_->unlinkat(dirfd, pathname, flags);
+}
+
+IoQueue::OperationHandle IoQueue::openatDirect(
+    int dirfd, const char* pathname, int flags, mode_t mode)
+{
+    return impl_->openatDirect(dirfd, pathname, flags, mode);
+}
+
+IoQueue::OperationHandle IoQueue::shutdown(AnyFd fd, int how)
 {
     return impl_->shutdown(fd, how);
 }
 
-IoQueue::OperationHandle IoQueue::poll(int fd, short events)
+IoQueue::OperationHandle IoQueue::splice(
+    AnyFd in, int64_t inOffset, AnyFd out, int64_t outOffset, size_t len, unsigned flags)
+{
+    return impl_->splice(in, inOffset, out, outOffset, len, flags);
+}
+
+IoQueue::OperationHandle IoQueue::tee(AnyFd in, AnyFd out, size_t len, unsigned flags)
+{
+    return impl_->tee(in, out, len, flags);
+}
+
+IoQueue::OperationHandle IoQueue::poll(AnyFd fd, short events)
 {
     return impl_->poll(fd, events);
 }
 
-IoQueue::OperationHandle IoQueue::recvmsg(int sockfd, ::msghdr* msg, int flags)
+IoQueue::OperationHandle IoQueue::recvmsg(AnyFd sockfd, ::msghdr* msg, int flags)
 {
     return impl_->recvmsg(sockfd, msg, flags);
 }
 
-IoQueue::OperationHandle IoQueue::sendmsg(int sockfd, const ::msghdr* msg, int flags)
+IoQueue::OperationHandle IoQueue::sendmsg(AnyFd sockfd, const ::msghdr* msg, int flags)
 {
     return impl_->sendmsg(sockfd, msg, flags);
 }
 
+IoQueue::ZeroCopySend IoQueue::sendmsgZc(AnyFd sockfd, const ::msghdr* msg, int flags)
+{
+    return ZeroCopySend(impl_->sendmsgZc(sockfd, msg, flags));
+}
+
 namespace {
     struct MsgHdr {
         ::iovec iov;
@@ -122,13 +275,13 @@ namespace {
 }
 
 Task<IoResult> IoQueue::recvfrom(
-    int sockfd, void* buf, size_t len, int flags, ::sockaddr* srcAddr, socklen_t addrLen)
+    AnyFd sockfd, void* buf, size_t len, int flags, ::sockaddr* srcAddr, socklen_t addrLen)
 {
     MsgHdr msgHdr(buf, len, srcAddr, addrLen);
     co_return co_await recvmsg(sockfd, &msgHdr.msg, flags);
 }
 
-Task<IoResult> IoQueue::sendto(int sockfd, const void* buf, size_t len, int flags,
+Task<IoResult> IoQueue::sendto(AnyFd sockfd, const void* buf, size_t len, int flags,
     const ::sockaddr* destAddr, socklen_t addrLen)
 {
     MsgHdr msgHdr(const_cast<void*>(buf), len, const_cast<::sockaddr*>(destAddr), addrLen);
@@ -153,29 +306,120 @@ Task<IoResult> IoQueue::timeout(TimePoint tp, OperationHandle op)
     return impl_->timeout(tp, op);
 }
 
+void IoQueue::armTimer(Timer& timer, TimePoint deadline)
+{
+    impl_->armTimer(timer, deadline);
+}
+
+void IoQueue::armTimer(Timer& timer, Duration timeout)
+{
+    impl_->armTimer(timer, TimePoint::clock::now() + timeout);
+}
+
+IoQueue::SleepAwaiter IoQueue::sleepUntil(TimePoint deadline)
+{
+    return SleepAwaiter(*this, deadline);
+}
+
+IoQueue::SleepAwaiter IoQueue::sleepFor(Duration duration)
+{
+    return SleepAwaiter(*this, TimePoint::clock::now() + duration);
+}
+
+IoQueue::DeadlineAwaiter IoQueue::withDeadline(OperationHandle operation, TimePoint deadline)
+{
+    return DeadlineAwaiter(operation, deadline);
+}
+
+IoQueue::DeadlineAwaiter IoQueue::withDeadline(OperationHandle operation, Duration timeout)
+{
+    return DeadlineAwaiter(operation, TimePoint::clock::now() + timeout);
+}
+
+IoQueue::Batch IoQueue::batch()
+{
+    return Batch(*this);
+}
+
 IoQueue::OperationHandle IoQueue::cancel(OperationHandle operation, bool cancelHandler)
 {
     return impl_->cancel(operation, cancelHandler);
 }
 
+bool IoQueue::post(IoQueue& target, Completer& completer, int32_t value)
+{
+    assert(value >= 0);
+    return impl_->post(*target.impl_, IoQueueImpl::packMessage(&completer), value);
+}
+
+bool IoQueue::post(IoQueue& target, Function<void()> func)
+{
+    return impl_->post(target, std::move(func));
+}
+
+bool IoQueue::post(IoQueue& target, std::coroutine_handle<> handle)
+{
+    return impl_->post(*target.impl_, IoQueueImpl::packMessage(handle), 0);
+}
+
+IoQueue::OperationHandle IoQueue::postDirectFd(IoQueue& target, AnyFd fd, Completer& completer)
+{
+    assert(fd.direct);
+    return impl_->postDirectFd(*target.impl_, fd.fd, IoQueueImpl::packMessage(&completer));
+}
+
+size_t IoQueue::getNumOperationsInFlight() const
+{
+    return impl_->numInFlight_.load(std::memory_order_relaxed);
+}
+
+IoQueue::SwitchAwaiter IoQueue::switchTo(IoQueue& target)
+{
+    return SwitchAwaiter(*this, target);
+}
+
 void IoQueue::run()
 {
     return impl_->run();
 }
 
-void IoQueue::setCompleter(OperationHandle operation, std::unique_ptr<Completer> completer)
+void IoQueue::stop()
 {
-    return impl_->setCompleter(operation, std::move(completer));
+    impl_->stopRequested_ = true;
 }
 
-IoQueue::OperationId IoQueue::getNextOpId()
+void IoQueue::setCompleter(OperationHandle operation, Completer* completer)
 {
-    // Just skip the magic values
-    if (nextOpId_ == OpIdInvalid || nextOpId_ == OpIdIgnore) {
-        nextOpId_ = 0;
-    }
-    const auto opId = nextOpId_;
-    nextOpId_++;
-    return opId;
+    return impl_->setCompleter(operation, completer);
+}
+
+void IoQueue::reserveSqes(size_t num)
+{
+    impl_->ring_.reserveSqes(num);
+}
+
+void IoQueue::linkLastOperation(OperationHandle operation, bool hardLink)
+{
+    impl_->linkLastOperation(operation, hardLink);
+}
+
+void IoQueue::endChain(OperationHandle lastOperation)
+{
+    impl_->endChain(lastOperation);
+}
+
+detail::CompletionInbox& IoQueue::getCompletionInbox()
+{
+    return impl_->completionInbox_;
+}
+
+void IoQueue::addInboxWaiter()
+{
+    impl_->addInboxWaiter();
+}
+
+void IoQueue::removeInboxWaiter()
+{
+    impl_->removeInboxWaiter();
 }
 }
@@ -1,5 +1,11 @@
 #include "aiopp/ioqueue_impl_iouring.hpp"
 
+#include <cerrno>
+#include <cstring>
+#include <utility>
+
+#include <unistd.h>
+
 #include "aiopp/util.hpp"
 
 namespace aiopp {
@@ -11,29 +17,119 @@ void setTimespec(Timespec& ts, std::chrono::milliseconds ms)
 
 void setTimespec(Timespec& ts, std::chrono::time_point<std::chrono::steady_clock> tp)
 {
-    const auto now = std::chrono::steady_clock::now();
-    assert(now >= tp);
-    const auto delta = tp - now;
-    const auto deltaMs = std::chrono::duration_cast<std::chrono::milliseconds>(delta).count();
+    // steady_clock is CLOCK_MONOTONIC, which is also the clock used for IORING_TIMEOUT_ABS
+    const auto ns
+        = std::chrono::duration_cast<std::chrono::nanoseconds>(tp.time_since_epoch()).count();
+    ts.tv_sec = ns / (1000 * 1000 * 1000);
+    ts.tv_nsec = ns % (1000 * 1000 * 1000);
+}
+
+namespace {
+    io_uring_sqe* useFd(io_uring_sqe* sqe, AnyFd fd)
+    {
+        if (sqe && fd.direct) {
+            sqe->flags |= IOSQE_FIXED_FILE;
+        }
+        return sqe;
+    }
 
-    ::timespec nowTs;
-    ::clock_gettime(CLOCK_MONOTONIC, &nowTs);
+    struct PostedFunction final : public Completer {
+        Function<void()> func;
 
-    ts.tv_sec = nowTs.tv_sec + deltaMs / 1000;
-    ts.tv_nsec = nowTs.tv_nsec + (deltaMs % 1000) * 1000 * 1000;
-    ts.tv_sec += ts.tv_nsec / (1000 * 1000 * 1000);
-    ts.tv_nsec = ts.tv_nsec % (1000 * 1000 * 1000);
+        PostedFunction(Function<void()> func)
+            : func(std::move(func))
+        {
+        }
+
+        void complete(IoResult result, uint32_t) override
+        {
+            if (result) {
+                func();
+            } else {
+                getLogger().log(LogSeverity::Error,
+                    "Could not post function to IoQueue: " + result.error().message());
+            }
+            delete this;
+        }
+    };
+
+    // Takes over the multishot accept of a destroyed accept stream and closes the connections
+    // that are still accepted until the cancelation has completed.
+    struct LateAcceptCloser final : public Completer {
+        IoQueue& io;
+        bool direct;
+
+        LateAcceptCloser(IoQueue& io, bool direct)
+            : io(io)
+            , direct(direct)
+        {
+        }
+
+        void complete(IoResult result, uint32_t flags) override
+        {
+            if (result) {
+                if (direct) {
+                    io.close(AnyFd::fromIndex(*result));
+                } else {
+                    ::close(*result);
+                }
+            }
+            if (!(flags & IORING_CQE_F_MORE)) {
+                delete this;
+            }
+        }
+    };
+
+    void handOverAccept(IoQueue& io, OperationHandle& operation, bool direct)
+    {
+        if (operation) {
+            operation.setCompleter(new LateAcceptCloser(io, direct));
+            operation.cancel(false);
+            operation = {};
+        }
+    }
 }
 
 IoQueueImpl::IoQueueImpl(IoQueue* parent, size_t size)
     : parent_(parent)
     , completers_(size)
 {
+    inboxReader_.impl = this;
+    timerTicker_.impl = this;
 }
 
-bool IoQueueImpl::init(bool submissionQueuePolling)
+bool IoQueueImpl::init(const IoQueue::Options& options)
 {
-    if (!ring_.init(completers_.capacity(), submissionQueuePolling)) {
+    io_uring_params params;
+    std::memset(&params, 0, sizeof(params));
+    if (options.completionQueueSize > 0) {
+        params.flags |= IORING_SETUP_CQSIZE;
+        params.cq_entries = static_cast<uint32_t>(options.completionQueueSize);
+    }
+    if (options.submissionQueuePolling) {
+        params.flags |= IORING_SETUP_SQPOLL;
+        if (options.sqPollCpu) {
+            params.flags |= IORING_SETUP_SQ_AFF;
+            params.sq_thread_cpu = static_cast<uint32_t>(*options.sqPollCpu);
+        }
+        params.sq_thread_idle = static_cast<uint32_t>(options.sqPollIdle.count());
+    }
+    if (options.singleIssuer || options.deferTaskrun) {
+        params.flags |= IORING_SETUP_SINGLE_ISSUER;
+    }
+    if (options.deferTaskrun) {
+        params.flags |= IORING_SETUP_DEFER_TASKRUN;
+    }
+    if (options.coopTaskrun) {
+        // With the flag, liburing knows when it has to enter the kernel to get completions
+        params.flags |= IORING_SETUP_COOP_TASKRUN | IORING_SETUP_TASKRUN_FLAG;
+    }
+    if (options.submitAll) {
+        params.flags |= IORING_SETUP_SUBMIT_ALL;
+    }
+    deferTaskrun_ = options.deferTaskrun;
+
+    if (!ring_.init(completers_.capacity(), params)) {
         getLogger().log(LogSeverity::Fatal, "Could not create io_uring: " + errnoToString(errno));
         return false;
     }
@@ -48,6 +144,82 @@ bool IoQueueImpl::init(bool submissionQueuePolling)
     return true;
 }
 
+void IoQueueImpl::addInboxWaiter()
+{
+    numInboxWaiters_++;
+    if (!inboxReadInFlight_) {
+        armInboxRead();
+    }
+}
+
+void IoQueueImpl::removeInboxWaiter()
+{
+    assert(numInboxWaiters_ > 0);
+    numInboxWaiters_--;
+    // Nothing will be pushed for us anymore and the read would keep run() from returning
+    if (numInboxWaiters_ == 0 && inboxReadInFlight_) {
+        cancel(inboxRead_, false);
+    }
+}
+
+void IoQueueImpl::armInboxRead()
+{
+    const auto op = read(completionInbox_.getEventFd().fd(), &inboxEventFdValue_,
+        sizeof(inboxEventFdValue_), 0);
+    if (!op) {
+        getLogger().log(LogSeverity::Fatal, "Could not read from completion inbox eventfd");
+        std::abort();
+    }
+    setCompleter(op, &inboxReader_);
+    inboxRead_ = op;
+    inboxReadInFlight_ = true;
+}
+
+void IoQueueImpl::InboxReader::complete(IoResult result, uint32_t)
+{
+    impl->inboxReadInFlight_ = false;
+    if (!result && result.error() == std::errc::operation_canceled) {
+        // See removeInboxWaiter. A waiter might have been added since.
+        if (impl->numInboxWaiters_ > 0) {
+            impl->armInboxRead();
+        }
+        return;
+    }
+    if (!result) {
+        getLogger().log(LogSeverity::Fatal,
+            "Error reading from completion inbox eventfd: " + result.error().message());
+        std::abort();
+    }
+
+    auto entry = impl->completionInbox_.takeAll();
+    while (entry) {
+        // The entry keeps the shared state of the future alive, which might be the last reference
+        const auto next = entry->next;
+        const auto owner = std::move(entry->owner);
+        assert(impl->numInboxWaiters_ > 0);
+        impl->numInboxWaiters_--;
+        if (!entry->cancelled) {
+            entry->handle.resume();
+        }
+        entry = next;
+    }
+
+    // If new waiters came in while resuming, they armed the read already.
+    if (impl->numInboxWaiters_ > 0 && !impl->inboxReadInFlight_) {
+        impl->armInboxRead();
+    }
+}
+
+bool IoQueueImpl::registerFileTable(size_t size)
+{
+    if (!ring_.registerFilesSparse(size)) {
+        getLogger().log(
+            LogSeverity::Error, "Could not register file table: " + errnoToString(errno));
+        return false;
+    }
+    return true;
+}
+
 size_t IoQueueImpl::getSize() const
 {
     return ring_.getNumSqeEntries();
@@ -58,54 +230,250 @@ size_t IoQueueImpl::getCapacity() const
     return ring_.getSqeCapacity();
 }
 
-OperationHandle IoQueueImpl::accept(int fd, ::sockaddr_in* addr, socklen_t* addrlen)
+OperationHandle IoQueueImpl::accept(AnyFd fd, ::sockaddr_in* addr, socklen_t* addrlen)
+{
+    return finalizeSqe(
+        useFd(ring_.prepareAccept(fd.fd, reinterpret_cast<sockaddr*>(addr), addrlen), fd));
+}
+
+OperationHandle IoQueueImpl::acceptDirect(AnyFd fd, ::sockaddr_in* addr, socklen_t* addrlen)
+{
+    return finalizeSqe(useFd(
+        ring_.prepareAcceptDirect(fd.fd, reinterpret_cast<sockaddr*>(addr), addrlen), fd));
+}
+
+OperationHandle IoQueueImpl::acceptMultishot(AnyFd fd)
+{
+    return finalizeSqe(useFd(ring_.prepareAcceptMultishot(fd.fd, nullptr, nullptr), fd));
+}
+
+OperationHandle IoQueueImpl::acceptMultishotDirect(AnyFd fd)
 {
-    return finalizeSqe(ring_.prepareAccept(fd, reinterpret_cast<sockaddr*>(addr), addrlen));
+    return finalizeSqe(useFd(ring_.prepareAcceptMultishotDirect(fd.fd, nullptr, nullptr), fd));
 }
 
-OperationHandle IoQueueImpl::connect(int sockfd, const ::sockaddr* addr, socklen_t addrlen)
+OperationHandle IoQueueImpl::connect(AnyFd sockfd, const ::sockaddr* addr, socklen_t addrlen)
 {
-    return finalizeSqe(ring_.prepareConnect(sockfd, addr, addrlen));
+    return finalizeSqe(useFd(ring_.prepareConnect(sockfd.fd, addr, addrlen), sockfd));
 }
 
-OperationHandle IoQueueImpl::send(int sockfd, const void* buf, size_t len)
+OperationHandle IoQueueImpl::send(AnyFd sockfd, const void* buf, size_t len)
 {
-    return finalizeSqe(ring_.prepareSend(sockfd, buf, len));
+    return finalizeSqe(useFd(ring_.prepareSend(sockfd.fd, buf, len), sockfd));
 }
 
-OperationHandle IoQueueImpl::recv(int sockfd, void* buf, size_t len)
+OperationHandle IoQueueImpl::sendZc(AnyFd sockfd, const void* buf, size_t len)
 {
-    return finalizeSqe(ring_.prepareRecv(sockfd, buf, len));
+    return finalizeSqe(useFd(ring_.prepareSendZc(sockfd.fd, buf, len), sockfd));
 }
 
-OperationHandle IoQueueImpl::read(int fd, void* buf, size_t count)
+OperationHandle IoQueueImpl::recv(AnyFd sockfd, void* buf, size_t len)
 {
-    return finalizeSqe(ring_.prepareRead(fd, buf, count));
+    return finalizeSqe(useFd(ring_.prepareRecv(sockfd.fd, buf, len), sockfd));
 }
 
-OperationHandle IoQueueImpl::close(int fd)
+OperationHandle IoQueueImpl::recv(AnyFd sockfd, uint16_t bufferGroupId)
 {
-    return finalizeSqe(ring_.prepareClose(fd));
+    return finalizeSqe(
+        useFd(ring_.prepareRecvBufferSelect(sockfd.fd, bufferGroupId), sockfd));
 }
 
-OperationHandle IoQueueImpl::shutdown(int fd, int how)
+OperationHandle IoQueueImpl::recvMultishot(AnyFd sockfd, uint16_t bufferGroupId)
 {
-    return finalizeSqe(ring_.prepareShutdown(fd, how));
+    return finalizeSqe(useFd(ring_.prepareRecvMultishot(sockfd.fd, bufferGroupId), sockfd));
 }
 
-OperationHandle IoQueueImpl::poll(int fd, short events)
+OperationHandle IoQueueImpl::read(AnyFd fd, void* buf, size_t count, uint64_t offset)
 {
-    return finalizeSqe(ring_.preparePollAdd(fd, events));
+    return finalizeSqe(
+        useFd(ring_.prepareRead(fd.fd, buf, count, static_cast<off_t>(offset)), fd));
 }
 
-OperationHandle IoQueueImpl::recvmsg(int sockfd, ::msghdr* msg, int flags)
+OperationHandle IoQueueImpl::write(AnyFd fd, const void* buf, size_t count, uint64_t offset)
 {
-    return finalizeSqe(ring_.prepareRecvmsg(sockfd, msg, flags));
+    return finalizeSqe(
+        useFd(ring_.prepareWrite(fd.fd, buf, count, static_cast<off_t>(offset)), fd));
 }
 
-OperationHandle IoQueueImpl::sendmsg(int sockfd, const ::msghdr* msg, int flags)
+OperationHandle IoQueueImpl::readv(AnyFd fd, const ::iovec* iov, int iovcnt, uint64_t offset)
 {
-    return finalizeSqe(ring_.prepareSendmsg(sockfd, msg, flags));
+    return finalizeSqe(
+        useFd(ring_.prepareReadv(fd.fd, iov, iovcnt, static_cast<off_t>(offset)), fd));
+}
+
+OperationHandle IoQueueImpl::writev(AnyFd fd, const ::iovec* iov, int iovcnt, uint64_t offset)
+{
+    return finalizeSqe(
+        useFd(ring_.prepareWritev(fd.fd, iov, iovcnt, static_cast<off_t>(offset)), fd));
+}
+
+OperationHandle IoQueueImpl::fsync(AnyFd fd, uint32_t flags)
+{
+    return finalizeSqe(useFd(ring_.prepareFsync(fd.fd, flags), fd));
+}
+
+OperationHandle IoQueueImpl::readFixed(
+    AnyFd fd, void* buf, size_t count, uint16_t bufIndex, uint64_t offset)
+{
+    return finalizeSqe(
+        useFd(ring_.prepareReadFixed(fd.fd, buf, count, bufIndex, offset), fd));
+}
+
+OperationHandle IoQueueImpl::writeFixed(
+    AnyFd fd, const void* buf, size_t count, uint16_t bufIndex, uint64_t offset)
+{
+    return finalizeSqe(
+        useFd(ring_.prepareWriteFixed(fd.fd, buf, count, bufIndex, offset), fd));
+}
+
+OperationHandle IoQueueImpl::sendFixed(AnyFd sockfd, const void* buf, size_t len, uint16_t bufIndex)
+{
+    return finalizeSqe(useFd(ring_.prepareSendFixed(sockfd.fd, buf, len, bufIndex), sockfd));
+}
+
+OperationHandle IoQueueImpl::close(AnyFd fd)
+{
+    if (fd.direct) {
+        return finalizeSqe(ring_.prepareCloseDirect(fd.fd));
+    }
+    return finalizeSqe(ring_.prepareClose(fd.fd));
+}
+
+OperationHandle IoQueueImpl::openat(int dirfd, const char* pathname, int flags, mode_t mode)
+{
+    return finalizeSqe(ring_.prepareOpenat(dirfd, pathname, flags, mode));
+}
+
+OperationHandle IoQueueImpl::openat2(int dirfd, const char* pathname, const ::open_how* how)
+{
+    return finalizeSqe(ring_.prepareOpenat2(dirfd, pathname, how));
+}
+
+OperationHandle IoQueueImpl::statx(
+    int dirfd, const char* pathname, int flags, unsigned int mask, struct ::statx* statxbuf)
+{
+    return finalizeSqe(ring_.prepareStatx(dirfd, pathname, flags, mask, statxbuf));
+}
+
+OperationHandle IoQueueImpl::renameat(
+    int olddirfd, const char* oldpath, int newdirfd, const char* newpath, int flags)
+{
+    return finalizeSqe(ring_.prepareRenameat(olddirfd, oldpath, newdirfd, newpath, flags));
+}
+
+OperationHandle IoQueueImpl::unlinkat(int dirfd, const char* pathname, int flags)
+{
+    return finalizeSqe(ring_.prepareUnlinkat(dirfd, pathname, flags));
+}
+
+OperationHandle IoQueueImpl::openatDirect(
+    int dirfd, const char* pathname, int flags, mode_t mode)
+{
+    return finalizeSqe(ring_.prepareOpenatDirect(dirfd, pathname, flags, mode));
+}
+
+OperationHandle IoQueueImpl::shutdown(AnyFd fd, int how)
+{
+    return finalizeSqe(useFd(ring_.prepareShutdown(fd.fd, how), fd));
+}
+
+OperationHandle IoQueueImpl::splice(
+    AnyFd in, int64_t inOffset, AnyFd out, int64_t outOffset, size_t len, unsigned flags)
+{
+    // IOSQE_FIXED_FILE only applies to `out`
+    if (in.direct) {
+        flags |= SPLICE_F_FD_IN_FIXED;
+    }
+    return finalizeSqe(
+        useFd(ring_.prepareSplice(in.fd, inOffset, out.fd, outOffset, len, flags), out));
+}
+
+OperationHandle IoQueueImpl::tee(AnyFd in, AnyFd out, size_t len, unsigned flags)
+{
+    if (in.direct) {
+        flags |= SPLICE_F_FD_IN_FIXED;
+    }
+    return finalizeSqe(useFd(ring_.prepareTee(in.fd, out.fd, len, flags), out));
+}
+
+OperationHandle IoQueueImpl::poll(AnyFd fd, short events)
+{
+    return finalizeSqe(useFd(ring_.preparePollAdd(fd.fd, events), fd));
+}
+
+OperationHandle IoQueueImpl::recvmsg(AnyFd sockfd, ::msghdr* msg, int flags)
+{
+    return finalizeSqe(useFd(ring_.prepareRecvmsg(sockfd.fd, msg, flags), sockfd));
+}
+
+OperationHandle IoQueueImpl::sendmsg(AnyFd sockfd, const ::msghdr* msg, int flags)
+{
+    return finalizeSqe(useFd(ring_.prepareSendmsg(sockfd.fd, msg, flags), sockfd));
+}
+
+OperationHandle IoQueueImpl::sendmsgZc(AnyFd sockfd, const ::msghdr* msg, int flags)
+{
+    return finalizeSqe(useFd(ring_.prepareSendmsgZc(sockfd.fd, msg, flags), sockfd));
+}
+
+void IoQueueImpl::armTimer(Timer& timer, TimePoint deadline)
+{
+    const auto tick = timerWheel_.arm(timer, deadline);
+    if (!timerOp_) {
+        scheduleTimerTick();
+    } else if (tick < timerWakeTick_) {
+        // The kernel timeout is only moved if this timer expires before all others
+        timerWakeTick_ = tick;
+        setTimespec(timerUpdateTimespec_, timerWheel_.getTime(tick));
+        // If the timeout completed already, this fails and the new timer is
+        // considered when the next tick is scheduled
+        const auto op = finalizeSqe(
+            ring_.prepareTimeoutUpdate(&timerUpdateTimespec_, timerOp_.id, IORING_TIMEOUT_ABS),
+            IoQueue::OpIdIgnore);
+        if (!op) {
+            getLogger().log(LogSeverity::Error, "Could not update timer wheel timeout");
+        }
+    }
+}
+
+void IoQueueImpl::scheduleTimerTick()
+{
+    const auto tick = timerWheel_.getNextTick();
+    if (!tick) {
+        return;
+    }
+    setTimespec(timerTimespec_, timerWheel_.getTime(*tick));
+    timerOp_ = timeout(&timerTimespec_, IORING_TIMEOUT_ABS);
+    if (!timerOp_) {
+        getLogger().log(LogSeverity::Error, "Could not submit timer wheel timeout");
+        return;
+    }
+    setCompleter(timerOp_, &timerTicker_);
+    timerWakeTick_ = *tick;
+}
+
+void IoQueueImpl::cancelIdleTimerTick()
+{
+    // Timers are canceled through the wheel directly (e.g. when an operation with a deadline
+    // completed in time), so this is only noticed here. The kernel timeout would keep run() going
+    // until it expired.
+    if (timerOp_ && timerWheel_.size() == 0) {
+        cancel(timerOp_, true);
+        timerOp_ = {};
+    }
+}
+
+void IoQueueImpl::TimerTicker::complete(IoResult result, uint32_t)
+{
+    if (!result && result.error().value() != ETIME) {
+        getLogger().log(
+            LogSeverity::Error, "Error in timer wheel timeout: " + result.error().message());
+    }
+    // timerOp_ is only reset afterwards, so timers armed by the callbacks don't submit a timeout.
+    // They can't expire before the tick that is being processed right now.
+    impl->timerWheel_.advance();
+    impl->timerOp_ = {};
+    impl->scheduleTimerTick();
 }
 
 OperationHandle IoQueueImpl::timeout(Timespec* ts, uint32_t flags)
@@ -130,8 +498,9 @@ Task<IoResult> IoQueueImpl::timeout(TimePoint tp)
 OperationHandle IoQueueImpl::linkTimeout(Timespec* ts, int flags, OperationHandle op)
 {
     assert(op);
-    assert(lastSqe_ && lastSqe_->user_data == op.id);
-    lastSqe_->flags |= IOSQE_IO_LINK;
+    const auto sqe = getLastSqe(op);
+    assert(sqe);
+    sqe->flags |= IOSQE_IO_LINK;
     if (!finalizeSqe(ring_.prepareLinkTimeout(ts, flags), IoQueue::OpIdIgnore)) {
         return {};
     }
@@ -140,11 +509,19 @@ OperationHandle IoQueueImpl::linkTimeout(Timespec* ts, int flags, OperationHandl
 
 Task<IoResult> IoQueueImpl::timeout(Timespec* ts, int flags, OperationHandle op)
 {
-    // TODO: Make this function check if op is lastSqe_ and if not, issue a regular timeout
-    // operation that does cancel(op, false) when it completes with ETIME.
-    // I think I need to await multiple operations (op and timeout) simultaneously for this, which
-    // is why I put it off for now.
-    co_return co_await linkTimeout(ts, flags, op);
+    // If the SQ is full, getting an SQE for the timeout would submit op alone and break the link,
+    // unless op went into the overflow queue already.
+    const auto canLink = ring_.getSqeCapacity() > 0 || ring_.getNumOverflowSqes() > 0;
+    if (getLastSqe(op) && canLink) {
+        co_return co_await linkTimeout(ts, flags, op);
+    }
+
+    // The operation can't be linked anymore, so it is canceled by a timer instead
+    const auto duration = std::chrono::duration_cast<TimePoint::duration>(
+        std::chrono::seconds(ts->tv_sec) + std::chrono::nanoseconds(ts->tv_nsec));
+    const auto deadline
+        = (flags & IORING_TIMEOUT_ABS) ? TimePoint(duration) : TimePoint::clock::now() + duration;
+    co_return co_await parent_->withDeadline(op, deadline);
 }
 
 Task<IoResult> IoQueueImpl::timeout(Duration dur, OperationHandle op)
@@ -166,58 +543,465 @@ OperationHandle IoQueueImpl::cancel(OperationHandle operation, bool cancelHandle
     assert(operation);
 
     if (cancelHandler) {
-        const auto ptr = completers_.remove(operation.id);
-        const auto completer = reinterpret_cast<Completer*>(ptr);
-        delete completer;
+        completers_.remove(operation.id);
     }
 
     return finalizeSqe(ring_.prepareAsyncCancel(operation.id), IoQueue::OpIdIgnore);
 }
 
+void IoQueueImpl::beginBatch()
+{
+    batchDepth_++;
+}
+
+void IoQueueImpl::endBatch()
+{
+    assert(batchDepth_ > 0);
+    batchDepth_--;
+    if (batchDepth_ > 0) {
+        return;
+    }
+    ring_.flushOverflow();
+    const auto res = ring_.submitSqes(0);
+    lastSqe_ = nullptr;
+    // Whatever could not be submitted now will be submitted by run()
+    if (res < 0 && res != -EBUSY && res != -EAGAIN) {
+        getLogger().log(LogSeverity::Error, "Error submitting batch: " + errnoToString(-res));
+    }
+}
+
+void IoQueueImpl::linkLastOperation(OperationHandle operation, bool hardLink)
+{
+    const auto sqe = getLastSqe(operation);
+    assert(sqe);
+    sqe->flags |= hardLink ? IOSQE_IO_HARDLINK : IOSQE_IO_LINK;
+}
+
+void IoQueueImpl::endChain(OperationHandle lastOperation)
+{
+    // If it was submitted already (or completed), the kernel has ended the chain with it
+    if (lastOperation) {
+        if (const auto sqe = getLastSqe(lastOperation)) {
+            sqe->flags &= ~(IOSQE_IO_LINK | IOSQE_IO_HARDLINK);
+        }
+    }
+    ring_.releaseReservedSqes();
+}
+
+uint64_t IoQueueImpl::packMessage(Completer* completer)
+{
+    const auto ptr = reinterpret_cast<uint64_t>(completer);
+    assert((ptr & (MessageTag | MessageHandleTag)) == 0);
+    return ptr | MessageTag;
+}
+
+uint64_t IoQueueImpl::packMessage(std::coroutine_handle<> handle)
+{
+    const auto ptr = reinterpret_cast<uint64_t>(handle.address());
+    assert((ptr & (MessageTag | MessageHandleTag)) == 0);
+    return ptr | MessageTag | MessageHandleTag;
+}
+
+void IoQueueImpl::completeMessage(uint64_t userData, IoResult result)
+{
+    const auto ptr = userData & ~(MessageTag | MessageHandleTag);
+    if (userData & MessageHandleTag) {
+        std::coroutine_handle<>::from_address(reinterpret_cast<void*>(ptr)).resume();
+    } else {
+        reinterpret_cast<Completer*>(ptr)->complete(result, 0);
+    }
+}
+
+bool IoQueueImpl::post(IoQueueImpl& target, uint64_t message, int32_t value)
+{
+    auto sqe = ring_.prepareMsgRing(target.ring_.getRingFd(), value, message);
+    if (!sqe) {
+        getLogger().log(LogSeverity::Warning, "io_uring full");
+        return false;
+    }
+    // If it fails, the CQE on this ring has the same user_data, so the message is completed here
+    // with the error. If it succeeds, the target owns the message, so we must not post a CQE here.
+    sqe->user_data = message;
+    sqe->flags |= IOSQE_CQE_SKIP_SUCCESS;
+    setLastSqe(sqe);
+    return true;
+}
+
+bool IoQueueImpl::post(IoQueue& target, Function<void()> func)
+{
+    auto posted = new PostedFunction(std::move(func));
+    if (!post(*target.impl_, packMessage(posted), 0)) {
+        delete posted;
+        return false;
+    }
+    return true;
+}
+
+OperationHandle IoQueueImpl::postDirectFd(IoQueueImpl& target, int index, uint64_t message)
+{
+    return finalizeSqe(ring_.prepareMsgRingFd(target.ring_.getRingFd(), index, message));
+}
+
+bool IoQueueImpl::hasPendingWork() const
+{
+    return completers_.size() > 0 || numIgnoredInFlight_ > 0 || ring_.getNumSqeReady() > 0
+        || ring_.getNumOverflowSqes() > 0 || ring_.getNumCqeReady() > 0;
+}
+
 void IoQueueImpl::run()
 {
-    while (completers_.size() > 0) {
-        lastSqe_ = nullptr;
-        const auto res = ring_.submitSqes(1);
-        if (res < 0) {
-            getLogger().log(LogSeverity::Error, "Error submitting SQEs: " + errnoToString(errno));
-            continue;
+    stopRequested_ = false;
+    while (true) {
+        cancelIdleTimerTick();
+        if (!hasPendingWork() || stopRequested_) {
+            break;
         }
-        const auto cqe = ring_.peekCqe();
-        if (!cqe) {
+        lastSqe_ = nullptr;
+        // SQEs that did not fit into the SQ go in now, as far as there is room
+        const auto numOverflow = ring_.flushOverflow();
+        // Only block if there is nothing to reap and nothing left to submit. If there are CQEs left
+        // and no SQEs have been prepared, this will not even enter the kernel.
+        // If only messages are left, no CQE will arrive, so we must only submit them.
+        const auto expectCqes = completers_.size() > 0 || numIgnoredInFlight_ > 0;
+        const auto waitCqes
+            = !expectCqes || ring_.getNumCqeReady() > 0 || numOverflow > 0 ? 0 : 1;
+        // With DEFER_TASKRUN completions are only posted when we ask for them, so if we enter the
+        // kernel anyways, we collect them too, which makes the batches larger.
+        const auto getEvents = deferTaskrun_ && waitCqes == 0 && ring_.getNumSqeReady() > 0;
+        const auto res = getEvents ? ring_.submitSqesAndGetEvents() : ring_.submitSqes(waitCqes);
+        // EBUSY means the CQ is full, so we need to reap first and submit in the next iteration
+        if (res < 0 && res != -EINTR && res != -EBUSY && res != -EAGAIN) {
+            getLogger().log(LogSeverity::Error, "Error submitting SQEs: " + errnoToString(-res));
             continue;
         }
 
-        if (cqe->user_data != IoQueue::OpIdIgnore) {
-            const auto ptr = completers_.remove(cqe->user_data);
+        // Completers might prepare new SQEs, but those will simply be submitted in the next
+        // iteration, together with everything else that has been prepared for this batch.
+        const auto numCqes = ring_.forEachCqe([this](const io_uring_cqe* cqe) {
+            if (cqe->user_data == IoQueue::OpIdIgnore) {
+                assert(numIgnoredInFlight_ > 0);
+                numIgnoredInFlight_--;
+                return;
+            }
+            if (cqe->user_data & MessageTag) {
+                completeMessage(cqe->user_data, cqe->res);
+                return;
+            }
+            // Multishot operations keep their completer until the last completion
+            const auto ptr = (cqe->flags & IORING_CQE_F_MORE) ? completers_.get(cqe->user_data)
+                                                              : completers_.remove(cqe->user_data);
             if (ptr) {
-                const auto completer = reinterpret_cast<Completer*>(ptr);
-                completer->complete(cqe->res);
-                delete completer;
+                // This might destroy the completer, so don't touch it afterwards.
+                reinterpret_cast<Completer*>(ptr)->complete(cqe->res, cqe->flags);
             }
-        }
-        ring_.advanceCq();
+        });
+        ring_.advanceCq(numCqes);
+        numInFlight_.store(completers_.size(), std::memory_order_relaxed);
     }
 }
 
 OperationHandle IoQueueImpl::finalizeSqe(io_uring_sqe* sqe, uint64_t userData)
 {
+    // IoURing::getSqe falls back to its overflow queue, so this should not happen
     if (!sqe) {
         getLogger().log(LogSeverity::Warning, "io_uring full");
         return {};
     }
     sqe->user_data = userData;
-    lastSqe_ = sqe;
+    if (userData == IoQueue::OpIdIgnore) {
+        numIgnoredInFlight_++;
+    }
+    setLastSqe(sqe);
     return { parent_, sqe->user_data };
 }
 
+void IoQueueImpl::setLastSqe(io_uring_sqe* sqe)
+{
+    lastSqe_ = sqe;
+    lastSqeSubmitCount_ = ring_.getSubmitCount();
+}
+
+io_uring_sqe* IoQueueImpl::getLastSqe(OperationHandle operation) const
+{
+    // After a submission the SQE might have been consumed by the kernel and reused already
+    if (!lastSqe_ || lastSqeSubmitCount_ != ring_.getSubmitCount()
+        || lastSqe_->user_data != operation.id) {
+        return nullptr;
+    }
+    return lastSqe_;
+}
+
 OperationHandle IoQueueImpl::finalizeSqe(io_uring_sqe* sqe)
 {
-    return finalizeSqe(sqe, parent_->getNextOpId());
+    // Only create an entry if we got an SQE, otherwise it would never be removed.
+    return finalizeSqe(sqe, sqe ? completers_.insert() : IoQueue::OpIdInvalid);
+}
+
+void IoQueueImpl::setCompleter(OperationHandle operation, Completer* completer)
+{
+    [[maybe_unused]] const auto res = completers_.set(operation.id, completer);
+    assert(res && "Operation has already completed");
+}
+
+IoQueue::SwitchAwaiter::SwitchAwaiter(IoQueue& io, IoQueue& target)
+    : io_(io)
+    , target_(target)
+{
+}
+
+bool IoQueue::SwitchAwaiter::await_suspend(std::coroutine_handle<> handle) noexcept
+{
+    caller_ = handle;
+    if (!io_.post(target_, *this)) {
+        result_ = -EBUSY;
+        return false;
+    }
+    return true;
+}
+
+void IoQueue::SwitchAwaiter::complete(IoResult result, uint32_t)
+{
+    result_ = result;
+    caller_.resume();
+}
+
+IoQueue::Batch::Batch(IoQueue& io)
+    : io_(io)
+{
+    io_.impl_->beginBatch();
+}
+
+IoQueue::Batch::~Batch()
+{
+    io_.impl_->endBatch();
+}
+
+IoQueue::SleepAwaiter::SleepAwaiter(IoQueue& io, TimePoint deadline)
+    : io_(io)
+    , deadline_(deadline)
+{
+}
+
+bool IoQueue::SleepAwaiter::await_ready() const noexcept
+{
+    return deadline_ <= TimePoint::clock::now();
+}
+
+void IoQueue::SleepAwaiter::await_suspend(std::coroutine_handle<> handle) noexcept
+{
+    caller_ = handle;
+    io_.armTimer(*this, deadline_);
+}
+
+void IoQueue::SleepAwaiter::expired()
+{
+    caller_.resume();
+}
+
+IoQueue::DeadlineAwaiter::DeadlineAwaiter(OperationHandle operation, TimePoint deadline)
+    : OperationAwaiter(operation)
+    , deadline(deadline)
+{
+}
+
+void IoQueue::DeadlineAwaiter::await_suspend(std::coroutine_handle<> handle) noexcept
+{
+    OperationAwaiter::await_suspend(handle);
+    operation.io->armTimer(*this, deadline);
+}
+
+void IoQueue::DeadlineAwaiter::complete(IoResult res, uint32_t cqeFlags)
+{
+    Timer::cancel();
+    OperationAwaiter::complete(res, cqeFlags);
 }
 
-void IoQueueImpl::setCompleter(OperationHandle operation, std::unique_ptr<Completer> completer)
+void IoQueue::DeadlineAwaiter::expired()
 {
-    completers_.insert(operation.id, completer.release());
+    // The operation will complete with ECANCELED
+    operation.cancel(false);
+}
+
+IoQueue::MultishotStream::MultishotStream(IoQueue& io)
+    : io_(io)
+{
+}
+
+IoQueue::MultishotStream::~MultishotStream()
+{
+    if (operation_) {
+        operation_.cancel(true);
+    }
+}
+
+void IoQueue::MultishotStream::cancel()
+{
+    if (operation_) {
+        operation_.cancel(false);
+    }
+}
+
+bool IoQueue::MultishotStream::ready()
+{
+    if (!completions_.empty() || finished_) {
+        return true;
+    }
+    if (!operation_) {
+        operation_ = arm();
+        if (!operation_) {
+            // The SQ is full, so there is nothing we can wait for
+            completions_.push_back(Completion { -EBUSY, 0 });
+            return true;
+        }
+        operation_.setCompleter(this);
+    }
+    return false;
+}
+
+IoQueue::MultishotStream::Completion IoQueue::MultishotStream::pop()
+{
+    if (completions_.empty()) {
+        assert(finished_);
+        return Completion { 0, 0 };
+    }
+    const auto completion = completions_.front();
+    completions_.pop_front();
+    return completion;
+}
+
+void IoQueue::MultishotStream::complete(IoResult result, uint32_t flags)
+{
+    if (!(flags & IORING_CQE_F_MORE)) {
+        // The completer has been removed already, so the stream will be armed again in ready().
+        operation_ = {};
+    }
+    completions_.push_back(Completion { result, flags });
+    if (waiter_) {
+        std::exchange(waiter_, nullptr).resume();
+    }
+}
+
+IoQueue::AcceptStream::AcceptStream(IoQueue& io, AnyFd listenFd)
+    : MultishotStream(io)
+    , listenFd_(listenFd)
+{
+}
+
+IoQueue::AcceptStream::~AcceptStream()
+{
+    // Close connections that have been accepted, but not consumed yet
+    for (const auto& completion : completions_) {
+        if (completion.result) {
+            ::close(*completion.result);
+        }
+    }
+    handOverAccept(io_, operation_, false);
+}
+
+OperationHandle IoQueue::AcceptStream::arm()
+{
+    return io_.impl_->acceptMultishot(listenFd_);
+}
+
+Result<IoQueue::AcceptStream::Connection> IoQueue::AcceptStream::convert(Completion completion)
+{
+    if (!completion.result) {
+        return error(completion.result.error());
+    }
+    Connection conn { Fd { *completion.result }, IpAddressPort {} };
+    ::sockaddr_in sa;
+    socklen_t saLen = sizeof(sa);
+    if (::getpeername(conn.fd, reinterpret_cast<::sockaddr*>(&sa), &saLen) == 0
+        && sa.sin_family == AF_INET) {
+        conn.peer = IpAddressPort(sa);
+    }
+    return conn;
+}
+
+IoQueue::DirectAcceptStream::DirectAcceptStream(IoQueue& io, AnyFd listenFd)
+    : MultishotStream(io)
+    , listenFd_(listenFd)
+{
+}
+
+IoQueue::DirectAcceptStream::~DirectAcceptStream()
+{
+    for (const auto& completion : completions_) {
+        if (completion.result) {
+            io_.close(AnyFd::fromIndex(*completion.result));
+        }
+    }
+    handOverAccept(io_, operation_, true);
+}
+
+OperationHandle IoQueue::DirectAcceptStream::arm()
+{
+    return io_.impl_->acceptMultishotDirect(listenFd_);
+}
+
+Result<DirectFd> IoQueue::DirectAcceptStream::convert(Completion completion)
+{
+    if (!completion.result) {
+        return error(completion.result.error());
+    }
+    return DirectFd(io_, *completion.result);
+}
+
+IoQueue::ZeroCopySend::ZeroCopySend(OperationHandle operation)
+    : operation_(operation)
+{
+    if (operation_) {
+        operation_.setCompleter(this);
+    } else {
+        // The SQ is full
+        result_ = IoResult(-EBUSY);
+        notification_ = IoResult(0);
+    }
+}
+
+IoQueue::ZeroCopySend::~ZeroCopySend()
+{
+    if (operation_) {
+        operation_.cancel(true);
+    }
+}
+
+bool IoQueue::ZeroCopySend::await_ready() const noexcept
+{
+    return resultConsumed_ ? released() : result_.has_value();
+}
+
+void IoQueue::ZeroCopySend::await_suspend(std::coroutine_handle<> handle) noexcept
+{
+    waiter_ = handle;
+}
+
+IoResult IoQueue::ZeroCopySend::await_resume() noexcept
+{
+    if (!resultConsumed_) {
+        resultConsumed_ = true;
+        return *result_;
+    }
+    return *notification_;
+}
+
+void IoQueue::ZeroCopySend::complete(IoResult result, uint32_t flags)
+{
+    if (flags & IORING_CQE_F_NOTIF) {
+        notification_ = result;
+    } else {
+        result_ = result;
+        // If the send failed, there will be no notification
+        if (!(flags & IORING_CQE_F_MORE)) {
+            notification_ = IoResult(0);
+        }
+    }
+    if (!(flags & IORING_CQE_F_MORE)) {
+        // This was the last completion, so the completer has been removed already
+        operation_ = {};
+    }
+    if (waiter_ && await_ready()) {
+        std::exchange(waiter_, nullptr).resume();
+    }
 }
 }
@@ -20,11 +20,18 @@ IoURing::~IoURing()
 
 bool IoURing::init(size_t sqEntries, bool sqPoll)
 {
-    ring_.ring_fd = -1;
-    std::memset(&params_, 0, sizeof(params_));
+    io_uring_params params;
+    std::memset(&params, 0, sizeof(params));
     if (sqPoll) {
-        params_.flags = IORING_SETUP_SQPOLL;
+        params.flags = IORING_SETUP_SQPOLL;
     }
+    return init(sqEntries, params);
+}
+
+bool IoURing::init(size_t sqEntries, const io_uring_params& params)
+{
+    ring_.ring_fd = -1;
+    params_ = params;
     const auto res = io_uring_queue_init_params(sqEntries, &ring_, &params_);
     if (res < 0) {
         errno = -res;
@@ -44,6 +51,11 @@ const io_uring_params& IoURing::getParams() const
     return params_;
 }
 
+int IoURing::getRingFd() const
+{
+    return ring_.ring_fd;
+}
+
 io_uring_cqe* IoURing::peekCqe()
 {
     assert(ring_.ring_fd != -1);
@@ -72,6 +84,56 @@ void IoURing::advanceCq(size_t num)
     io_uring_cq_advance(&ring_, num);
 }
 
+size_t IoURing::getNumCqeReady() const
+{
+    return io_uring_cq_ready(&ring_);
+}
+
+bool IoURing::registerFilesSparse(size_t num)
+{
+    assert(ring_.ring_fd != -1);
+    const auto res = io_uring_register_files_sparse(&ring_, num);
+    if (res < 0) {
+        errno = -res;
+        return false;
+    }
+    return true;
+}
+
+bool IoURing::registerBuffers(const iovec* iovecs, size_t numIovecs)
+{
+    assert(ring_.ring_fd != -1);
+    const auto res = io_uring_register_buffers(&ring_, iovecs, numIovecs);
+    if (res < 0) {
+        errno = -res;
+        return false;
+    }
+    return true;
+}
+
+void IoURing::unregisterBuffers()
+{
+    assert(ring_.ring_fd != -1);
+    io_uring_unregister_buffers(&ring_);
+}
+
+io_uring_buf_ring* IoURing::setupBufferRing(unsigned int numEntries, uint16_t groupId)
+{
+    assert(ring_.ring_fd != -1);
+    int res = 0;
+    const auto bufRing = io_uring_setup_buf_ring(&ring_, numEntries, groupId, 0, &res);
+    if (!bufRing) {
+        errno = -res;
+    }
+    return bufRing;
+}
+
+void IoURing::freeBufferRing(io_uring_buf_ring* bufRing, unsigned int numEntries, uint16_t groupId)
+{
+    assert(ring_.ring_fd != -1);
+    io_uring_free_buf_ring(&ring_, bufRing, numEntries, groupId);
+}
+
 size_t IoURing::getNumSqeEntries() const
 {
     return params_.sq_entries;
@@ -85,15 +147,90 @@ size_t IoURing::getSqeCapacity() const
 io_uring_sqe* IoURing::getSqe()
 {
     assert(ring_.ring_fd != -1);
-    return io_uring_get_sqe(&ring_);
+    if (overflow_.empty() && numReservedOverflow_ == 0) {
+        if (auto sqe = io_uring_get_sqe(&ring_)) {
+            return sqe;
+        }
+        // Without SQPOLL this consumes the whole SQ, unless the CQ is full (EBUSY)
+        io_uring_submit(&ring_);
+        submitCount_++;
+        if (auto sqe = io_uring_get_sqe(&ring_)) {
+            return sqe;
+        }
+    }
+    if (numReservedOverflow_ > 0) {
+        numReservedOverflow_--;
+    }
+    return &overflow_.emplace_back();
+}
+
+size_t IoURing::flushOverflow()
+{
+    assert(ring_.ring_fd != -1);
+    constexpr auto linkFlags = IOSQE_IO_LINK | IOSQE_IO_HARDLINK;
+    while (!overflow_.empty()) {
+        size_t chainLength = 1;
+        while (chainLength <= overflow_.size() && (overflow_[chainLength - 1].flags & linkFlags)) {
+            chainLength++;
+        }
+        assert(chainLength <= getNumSqeEntries() && "Link chain longer than the SQ");
+        if (chainLength > overflow_.size() || chainLength > getSqeCapacity()) {
+            break;
+        }
+        submitCount_++;
+        for (size_t i = 0; i < chainLength; ++i) {
+            const auto sqe = io_uring_get_sqe(&ring_);
+            assert(sqe);
+            *sqe = overflow_.front();
+            overflow_.pop_front();
+        }
+    }
+    return overflow_.size();
+}
+
+size_t IoURing::getNumOverflowSqes() const
+{
+    return overflow_.size();
+}
+
+void IoURing::reserveSqes(size_t num)
+{
+    assert(ring_.ring_fd != -1);
+    assert(num <= getNumSqeEntries());
+    if (!overflow_.empty() || getSqeCapacity() >= num) {
+        return;
+    }
+    io_uring_submit(&ring_);
+    submitCount_++;
+    if (getSqeCapacity() < num) {
+        numReservedOverflow_ = num;
+    }
+}
+
+void IoURing::releaseReservedSqes()
+{
+    numReservedOverflow_ = 0;
 }
 
 int IoURing::submitSqes(size_t waitCqes)
 {
     assert(ring_.ring_fd != -1);
+    submitCount_++;
     return io_uring_submit_and_wait(&ring_, waitCqes);
 }
 
+int IoURing::submitSqesAndGetEvents()
+{
+    assert(ring_.ring_fd != -1);
+    submitCount_++;
+    return io_uring_submit_and_get_events(&ring_);
+}
+
+size_t IoURing::getNumSqeReady() const
+{
+    return io_uring_sq_ready(&ring_);
+}
+
 io_uring_sqe* IoURing::prepare(uint8_t opcode, int fd, uint64_t off, const void* addr, uint32_t len)
 {
     auto sqe = getSqe();
@@ -112,7 +249,8 @@ io_uring_sqe* IoURing::prepare(uint8_t opcode, int fd, uint64_t off, const void*
     sqe->buf_index = 0;
     sqe->personality = 0;
     sqe->splice_fd_in = 0;
-    sqe->__pad2[0] = sqe->__pad2[1] = 0;
+    sqe->addr3 = 0;
+    sqe->__pad2[0] = 0;
     return sqe;
 }
 
@@ -140,6 +278,26 @@ io_uring_sqe* IoURing::prepareFsync(int fd, uint32_t flags)
     return sqe;
 }
 
+io_uring_sqe* IoURing::prepareReadFixed(
+    int fd, void* buf, size_t count, uint16_t bufIndex, off_t offset)
+{
+    auto sqe = prepare(IORING_OP_READ_FIXED, fd, offset, buf, count);
+    if (sqe) {
+        sqe->buf_index = bufIndex;
+    }
+    return sqe;
+}
+
+io_uring_sqe* IoURing::prepareWriteFixed(
+    int fd, const void* buf, size_t count, uint16_t bufIndex, off_t offset)
+{
+    auto sqe = prepare(IORING_OP_WRITE_FIXED, fd, offset, buf, count);
+    if (sqe) {
+        sqe->buf_index = bufIndex;
+    }
+    return sqe;
+}
+
 io_uring_sqe* IoURing::preparePollAdd(int fd, short events, uint32_t flags)
 {
     auto sqe = prepare(IORING_OP_POLL_ADD, fd, 0, nullptr, flags);
@@ -200,6 +358,15 @@ io_uring_sqe* IoURing::prepareTimeoutRemove(uint64_t userData, uint32_t flags)
     return sqe;
 }
 
+io_uring_sqe* IoURing::prepareTimeoutUpdate(Timespec* ts, uint64_t userData, uint32_t flags)
+{
+    auto sqe = prepareTimeoutRemove(userData, flags | IORING_TIMEOUT_UPDATE);
+    if (sqe) {
+        sqe->addr2 = reinterpret_cast<uint64_t>(ts);
+    }
+    return sqe;
+}
+
 io_uring_sqe* IoURing::prepareAccept(int sockfd, sockaddr* addr, socklen_t* addrlen, uint32_t flags)
 {
     auto sqe = prepare(IORING_OP_ACCEPT, sockfd, 0, addr, 0);
@@ -210,11 +377,71 @@ io_uring_sqe* IoURing::prepareAccept(int sockfd, sockaddr* addr, socklen_t* addr
     return sqe;
 }
 
+namespace {
+    // In the SQE, 0 means "no direct descriptor", so the index is offset by one
+    void setFileIndex(io_uring_sqe* sqe, uint32_t fileIndex)
+    {
+        sqe->file_index = fileIndex == IORING_FILE_INDEX_ALLOC ? fileIndex : fileIndex + 1;
+    }
+}
+
+io_uring_sqe* IoURing::prepareAcceptDirect(
+    int sockfd, sockaddr* addr, socklen_t* addrlen, uint32_t flags, uint32_t fileIndex)
+{
+    auto sqe = prepareAccept(sockfd, addr, addrlen, flags);
+    if (sqe) {
+        setFileIndex(sqe, fileIndex);
+    }
+    return sqe;
+}
+
+io_uring_sqe* IoURing::prepareAcceptMultishot(
+    int sockfd, sockaddr* addr, socklen_t* addrlen, uint32_t flags)
+{
+    auto sqe = prepareAccept(sockfd, addr, addrlen, flags);
+    if (sqe) {
+        sqe->ioprio |= IORING_ACCEPT_MULTISHOT;
+    }
+    return sqe;
+}
+
+io_uring_sqe* IoURing::prepareAcceptMultishotDirect(
+    int sockfd, sockaddr* addr, socklen_t* addrlen, uint32_t flags)
+{
+    auto sqe = prepareAcceptDirect(sockfd, addr, addrlen, flags, IORING_FILE_INDEX_ALLOC);
+    if (sqe) {
+        sqe->ioprio |= IORING_ACCEPT_MULTISHOT;
+    }
+    return sqe;
+}
+
 io_uring_sqe* IoURing::prepareAsyncCancel(uint64_t userData)
 {
     return prepare(IORING_OP_ASYNC_CANCEL, -1, 0, reinterpret_cast<void*>(userData), 0);
 }
 
+io_uring_sqe* IoURing::prepareMsgRing(int targetRingFd, uint32_t len, uint64_t data, uint32_t flags)
+{
+    auto sqe = prepare(IORING_OP_MSG_RING, targetRingFd, data, nullptr, len);
+    if (sqe) {
+        sqe->msg_ring_flags = flags;
+    }
+    return sqe;
+}
+
+io_uring_sqe* IoURing::prepareMsgRingFd(
+    int targetRingFd, uint32_t sourceIndex, uint64_t data, uint32_t targetIndex, uint32_t flags)
+{
+    auto sqe = prepare(IORING_OP_MSG_RING, targetRingFd, data,
+        reinterpret_cast<void*>(static_cast<uintptr_t>(IORING_MSG_SEND_FD)), 0);
+    if (sqe) {
+        sqe->addr3 = sourceIndex;
+        setFileIndex(sqe, targetIndex);
+        sqe->msg_ring_flags = flags;
+    }
+    return sqe;
+}
+
 io_uring_sqe* IoURing::prepareLinkTimeout(Timespec* ts, uint32_t flags)
 {
     auto sqe = prepare(IORING_OP_LINK_TIMEOUT, -1, 0, ts, 1);
@@ -238,11 +465,30 @@ io_uring_sqe* IoURing::prepareOpenat(int dirfd, const char* pathname, int flags,
     return sqe;
 }
 
+io_uring_sqe* IoURing::prepareOpenatDirect(
+    int dirfd, const char* pathname, int flags, mode_t mode, uint32_t fileIndex)
+{
+    auto sqe = prepareOpenat(dirfd, pathname, flags, mode);
+    if (sqe) {
+        setFileIndex(sqe, fileIndex);
+    }
+    return sqe;
+}
+
 io_uring_sqe* IoURing::prepareClose(int fd)
 {
     return prepare(IORING_OP_CLOSE, fd, 0, nullptr, 0);
 }
 
+io_uring_sqe* IoURing::prepareCloseDirect(uint32_t fileIndex)
+{
+    auto sqe = prepare(IORING_OP_CLOSE, 0, 0, nullptr, 0);
+    if (sqe) {
+        setFileIndex(sqe, fileIndex);
+    }
+    return sqe;
+}
+
 io_uring_sqe* IoURing::prepareStatx(
     int dirfd, const char* pathname, int flags, unsigned int mask, struct statx* statxbuf)
 {
@@ -273,6 +519,34 @@ io_uring_sqe* IoURing::prepareSend(int sockfd, const void* buf, size_t len, int
     return sqe;
 }
 
+io_uring_sqe* IoURing::prepareSendFixed(
+    int sockfd, const void* buf, size_t len, uint16_t bufIndex)
+{
+    // The offset is ignored for sockets
+    return prepareWriteFixed(sockfd, buf, len, bufIndex, 0);
+}
+
+io_uring_sqe* IoURing::prepareSendZc(
+    int sockfd, const void* buf, size_t len, int flags, uint16_t zcFlags)
+{
+    auto sqe = prepare(IORING_OP_SEND_ZC, sockfd, 0, buf, len);
+    if (sqe) {
+        sqe->msg_flags = flags;
+        sqe->ioprio = zcFlags;
+    }
+    return sqe;
+}
+
+io_uring_sqe* IoURing::prepareSendmsgZc(int sockfd, const msghdr* msg, int flags, uint16_t zcFlags)
+{
+    auto sqe = prepare(IORING_OP_SENDMSG_ZC, sockfd, 0, msg, 1);
+    if (sqe) {
+        sqe->msg_flags = flags;
+        sqe->ioprio = zcFlags;
+    }
+    return sqe;
+}
+
 io_uring_sqe* IoURing::prepareRecv(int sockfd, void* buf, size_t len, int flags)
 {
     auto sqe = prepare(IORING_OP_RECV, sockfd, 0, buf, len);
@@ -282,6 +556,26 @@ io_uring_sqe* IoURing::prepareRecv(int sockfd, void* buf, size_t len, int flags)
     return sqe;
 }
 
+io_uring_sqe* IoURing::prepareRecvBufferSelect(
+    int sockfd, uint16_t bufferGroupId, size_t len, int flags)
+{
+    auto sqe = prepareRecv(sockfd, nullptr, len, flags);
+    if (sqe) {
+        sqe->flags |= IOSQE_BUFFER_SELECT;
+        sqe->buf_group = bufferGroupId;
+    }
+    return sqe;
+}
+
+io_uring_sqe* IoURing::prepareRecvMultishot(int sockfd, uint16_t bufferGroupId, int flags)
+{
+    auto sqe = prepareRecvBufferSelect(sockfd, bufferGroupId, 0, flags);
+    if (sqe) {
+        sqe->ioprio |= IORING_RECV_MULTISHOT;
+    }
+    return sqe;
+}
+
 io_uring_sqe* IoURing::prepareOpenat2(int dirfd, const char* pathname, const open_how* how)
 {
     return prepare(
@@ -294,6 +588,30 @@ io_uring_sqe* IoURing::prepareEpollCtl(int epfd, int op, int fd, epoll_event* ev
         reinterpret_cast<void*>(fd), op);
 }
 
+io_uring_sqe* IoURing::prepareSplice(
+    int fdIn, int64_t offIn, int fdOut, int64_t offOut, size_t len, unsigned int flags)
+{
+    auto sqe = prepare(IORING_OP_SPLICE, fdOut, static_cast<uint64_t>(offOut), nullptr,
+        static_cast<uint32_t>(len));
+    if (sqe) {
+        sqe->splice_off_in = static_cast<uint64_t>(offIn);
+        sqe->splice_fd_in = fdIn;
+        sqe->splice_flags = flags;
+    }
+    return sqe;
+}
+
+io_uring_sqe* IoURing::prepareTee(int fdIn, int fdOut, size_t len, unsigned int flags)
+{
+    auto sqe = prepare(IORING_OP_TEE, fdOut, 0, nullptr, static_cast<uint32_t>(len));
+    if (sqe) {
+        sqe->splice_off_in = 0;
+        sqe->splice_fd_in = fdIn;
+        sqe->splice_flags = flags;
+    }
+    return sqe;
+}
+
 io_uring_sqe* IoURing::prepareShutdown(int fd, int how)
 {
     return prepare(IORING_OP_SHUTDOWN, fd, 0, nullptr, how);
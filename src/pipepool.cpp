@@ -0,0 +1,55 @@
+#include "aiopp/pipepool.hpp"
+
+#include <cassert>
+#include <cerrno>
+#include <utility>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "aiopp/log.hpp"
+#include "aiopp/util.hpp"
+
+namespace aiopp {
+PipePool::PipePool(size_t pipeSize, size_t maxPooled)
+    : pipeSize_(pipeSize)
+    , maxPooled_(maxPooled)
+{
+}
+
+std::optional<Pipe> PipePool::acquire()
+{
+    if (!pipes_.empty()) {
+        auto pipe = std::move(pipes_.back());
+        pipes_.pop_back();
+        return pipe;
+    }
+
+    int fds[2];
+    if (::pipe2(fds, O_CLOEXEC | O_NONBLOCK) == -1) {
+        getLogger().log(LogSeverity::Error, "Could not create pipe: " + errnoToString(errno));
+        return std::nullopt;
+    }
+    Pipe pipe { Fd { fds[0] }, Fd { fds[1] } };
+
+    // Not fatal, the pipe just keeps its default size (usually 64K)
+    if (pipeSize_ && ::fcntl(pipe.write, F_SETPIPE_SZ, static_cast<int>(pipeSize_)) == -1) {
+        getLogger().log(
+            LogSeverity::Warning, "Could not set pipe size: " + errnoToString(errno));
+    }
+    return pipe;
+}
+
+void PipePool::release(Pipe pipe)
+{
+    assert(pipe.read != -1 && pipe.write != -1);
+    if (pipes_.size() < maxPooled_) {
+        pipes_.push_back(std::move(pipe));
+    }
+}
+
+size_t PipePool::size() const
+{
+    return pipes_.size();
+}
+}
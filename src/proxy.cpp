@@ -0,0 +1,113 @@
+#include "aiopp/proxy.hpp"
+
+#include <cerrno>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/socket.h>
+
+#include "aiopp/wait.hpp"
+
+namespace aiopp {
+namespace {
+    struct Direction {
+        uint64_t bytes = 0;
+        std::error_code error;
+    };
+
+    Task<void> forward(IoQueue& io, AnyFd from, AnyFd to, PipePool& pipes, size_t chunkSize,
+        Direction& direction)
+    {
+        auto pipe = pipes.acquire();
+        if (!pipe) {
+            direction.error = std::make_error_code(std::errc::too_many_files_open);
+            co_await io.shutdown(from, SHUT_RDWR);
+            co_await io.shutdown(to, SHUT_RDWR);
+            co_return;
+        }
+
+        // Invariant: The pipe is empty at the start of every iteration
+        while (true) {
+            // Receiving less than chunkSize is the usual case, but a short splice counts as a
+            // failure for IOSQE_IO_LINK and would cancel the second one. With a hard link the
+            // second splice always starts and moves whatever is in the pipe.
+            auto chain = io.chain<2>(true);
+            chain.add(io.splice(from, -1, pipe->write, -1, chunkSize, SPLICE_F_MOVE));
+            chain.add(io.splice(pipe->read, -1, to, -1, chunkSize, SPLICE_F_MOVE));
+
+            // If the first splice failed or hit EOF, nothing will arrive in the pipe and the second
+            // one would wait forever, so it is canceled.
+            const auto received = co_await chain.step(0);
+            if (!received || *received == 0) {
+                chain.cancel();
+            }
+
+            const auto [in, out] = co_await chain;
+            if (!in) {
+                direction.error = in.error();
+                break;
+            }
+            if (*in == 0) {
+                break;
+            }
+            if (!out) {
+                direction.error = out.error();
+                break;
+            }
+            direction.bytes += static_cast<uint64_t>(*out);
+
+            if (*out < *in) {
+                // The pipe has to be empty for the next iteration
+                const auto drained
+                    = co_await spliceAll(io, pipe->read, to, static_cast<size_t>(*in - *out));
+                if (!drained) {
+                    direction.error = drained.error();
+                    break;
+                }
+                direction.bytes += static_cast<uint64_t>(*drained);
+            }
+        }
+
+        if (direction.error) {
+            // Wakes up the other direction, which will then see an EOF. The pipe might not be
+            // empty, so it is not reused.
+            co_await io.shutdown(from, SHUT_RDWR);
+            co_await io.shutdown(to, SHUT_RDWR);
+        } else {
+            co_await io.shutdown(to, SHUT_WR);
+            pipes.release(std::move(*pipe));
+        }
+    }
+}
+
+Task<IoResult> spliceAll(IoQueue& io, AnyFd in, AnyFd out, size_t len)
+{
+    size_t total = 0;
+    while (total < len) {
+        const auto res = co_await io.splice(in, -1, out, -1, len - total, SPLICE_F_MOVE);
+        if (!res) {
+            co_return res;
+        }
+        if (*res == 0) {
+            co_return -EPIPE;
+        }
+        total += static_cast<size_t>(*res);
+    }
+    co_return static_cast<int>(total);
+}
+
+Task<ProxyResult> proxyBidirectional(
+    IoQueue& io, AnyFd a, AnyFd b, PipePool& pipes, size_t chunkSize)
+{
+    Direction aToB, bToA;
+    co_await WaitAll {
+        forward(io, a, b, pipes, chunkSize, aToB),
+        forward(io, b, a, pipes, chunkSize, bToA),
+    };
+    co_return ProxyResult {
+        .bytesAToB = aToB.bytes,
+        .bytesBToA = bToA.bytes,
+        .error = aToB.error ? aToB.error : bToA.error,
+    };
+}
+}
@@ -0,0 +1,144 @@
+#include "aiopp/registeredbufferpool.hpp"
+
+#include <cassert>
+#include <utility>
+
+#include <sys/mman.h>
+
+#include "aiopp/ioqueue_impl_iouring.hpp"
+#include "aiopp/log.hpp"
+#include "aiopp/util.hpp"
+
+namespace aiopp {
+RegisteredBuffer::RegisteredBuffer(
+    RegisteredBufferPool* pool, uint16_t index, std::byte* data, size_t size)
+    : pool_(pool)
+    , index_(index)
+    , data_(data)
+    , size_(size)
+{
+}
+
+RegisteredBuffer::RegisteredBuffer(RegisteredBuffer&& other)
+    : pool_(std::exchange(other.pool_, nullptr))
+    , index_(other.index_)
+    , data_(std::exchange(other.data_, nullptr))
+    , size_(std::exchange(other.size_, 0))
+{
+}
+
+RegisteredBuffer::~RegisteredBuffer()
+{
+    release();
+}
+
+RegisteredBuffer& RegisteredBuffer::operator=(RegisteredBuffer&& other)
+{
+    release();
+    pool_ = std::exchange(other.pool_, nullptr);
+    index_ = other.index_;
+    data_ = std::exchange(other.data_, nullptr);
+    size_ = std::exchange(other.size_, 0);
+    return *this;
+}
+
+void RegisteredBuffer::release()
+{
+    if (pool_) {
+        pool_->release(index_);
+    }
+    pool_ = nullptr;
+    data_ = nullptr;
+    size_ = 0;
+}
+
+namespace {
+    constexpr size_t HugePageSize = 2 * 1024 * 1024;
+
+    void* map(size_t size, bool hugePages)
+    {
+        const auto flags = MAP_PRIVATE | MAP_ANONYMOUS | (hugePages ? MAP_HUGETLB : 0);
+        return ::mmap(nullptr, size, PROT_READ | PROT_WRITE, flags, -1, 0);
+    }
+}
+
+RegisteredBufferPool::RegisteredBufferPool(
+    IoQueue& io, size_t numChunks, size_t chunkSize, bool hugePages)
+    : io_(io)
+    , numChunks_(numChunks)
+    , chunkSize_(chunkSize)
+{
+    assert(numChunks > 0 && numChunks <= 16384);
+    assert(chunkSize > 0);
+
+    const auto size = numChunks_ * chunkSize_;
+    void* mem = MAP_FAILED;
+    if (hugePages) {
+        mappingSize_ = (size + HugePageSize - 1) / HugePageSize * HugePageSize;
+        mem = map(mappingSize_, true);
+        if (mem == MAP_FAILED) {
+            getLogger().log(LogSeverity::Warning,
+                "Could not allocate huge pages for registered buffers: " + errnoToString(errno));
+        }
+    }
+    if (mem == MAP_FAILED) {
+        mappingSize_ = size;
+        mem = map(mappingSize_, false);
+    }
+    if (mem == MAP_FAILED) {
+        getLogger().log(LogSeverity::Error,
+            "Could not allocate memory for registered buffers: " + errnoToString(errno));
+        return;
+    }
+    memory_ = static_cast<std::byte*>(mem);
+
+    std::vector<::iovec> iovecs(numChunks_);
+    for (size_t i = 0; i < numChunks_; ++i) {
+        iovecs[i].iov_base = getChunkData(static_cast<uint16_t>(i));
+        iovecs[i].iov_len = chunkSize_;
+    }
+    if (!io_.impl_->ring_.registerBuffers(iovecs.data(), iovecs.size())) {
+        getLogger().log(LogSeverity::Error, "Could not register buffers: " + errnoToString(errno));
+        return;
+    }
+    registered_ = true;
+
+    // Reversed, so lower indices are handed out first
+    freeChunks_.reserve(numChunks_);
+    for (size_t i = numChunks_; i > 0; --i) {
+        freeChunks_.push_back(static_cast<uint16_t>(i - 1));
+    }
+}
+
+RegisteredBufferPool::~RegisteredBufferPool()
+{
+    assert(freeChunks_.size() == (registered_ ? numChunks_ : 0));
+    if (registered_) {
+        io_.impl_->ring_.unregisterBuffers();
+    }
+    if (memory_) {
+        ::munmap(memory_, mappingSize_);
+    }
+}
+
+RegisteredBuffer RegisteredBufferPool::acquire()
+{
+    if (freeChunks_.empty()) {
+        return RegisteredBuffer {};
+    }
+    const auto index = freeChunks_.back();
+    freeChunks_.pop_back();
+    return RegisteredBuffer(this, index, getChunkData(index), chunkSize_);
+}
+
+void RegisteredBufferPool::release(uint16_t index)
+{
+    assert(index < numChunks_ && freeChunks_.size() < numChunks_);
+    freeChunks_.push_back(index);
+}
+
+std::byte* RegisteredBufferPool::getChunkData(uint16_t index) const
+{
+    return memory_ + index * chunkSize_;
+}
+}
@@ -0,0 +1,193 @@
+#include "aiopp/runtime.hpp"
+
+#include <algorithm>
+#include <cassert>
+
+#include <pthread.h>
+#include <sched.h>
+
+#include "aiopp/log.hpp"
+#include "aiopp/util.hpp"
+
+namespace aiopp {
+namespace {
+    std::vector<int> getAllowedCpus()
+    {
+        ::cpu_set_t set;
+        CPU_ZERO(&set);
+        if (::sched_getaffinity(0, sizeof(set), &set) == -1) {
+            getLogger().log(
+                LogSeverity::Error, "Could not get CPU affinity: " + errnoToString(errno));
+            return {};
+        }
+        std::vector<int> cpus;
+        for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+            if (CPU_ISSET(cpu, &set)) {
+                cpus.push_back(cpu);
+            }
+        }
+        return cpus;
+    }
+
+    void pinCurrentThread(int cpu)
+    {
+        ::cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        const auto res = ::pthread_setaffinity_np(::pthread_self(), sizeof(set), &set);
+        if (res != 0) {
+            getLogger().log(LogSeverity::Warning,
+                "Could not pin thread to CPU " + std::to_string(cpu) + ": " + errnoToString(res));
+        }
+    }
+}
+
+Runtime::Runtime()
+    : Runtime(Options {})
+{
+}
+
+Runtime::Runtime(Options options)
+    : options_(options)
+{
+    const auto cpus = getAllowedCpus();
+    auto numThreads = options_.numThreads;
+    if (numThreads == 0) {
+        numThreads = std::max(cpus.size(), 1ul);
+    }
+
+    for (size_t i = 0; i < numThreads; ++i) {
+        workers_.push_back(std::make_unique<Worker>());
+    }
+
+    // The IoQueues are created on their threads, so they are never touched by another thread.
+    std::latch started(static_cast<ptrdiff_t>(numThreads));
+    for (size_t i = 0; i < numThreads; ++i) {
+        const auto cpu = options_.pinThreads && !cpus.empty() ? cpus[i % cpus.size()] : -1;
+        workers_[i]->cpu = cpu;
+        workers_[i]->thread = std::thread(
+            &Runtime::workerFunc, this, std::ref(*workers_[i]), cpu, std::ref(started));
+    }
+    started.wait();
+}
+
+Runtime::~Runtime()
+{
+    stop();
+    join();
+}
+
+size_t Runtime::getNumCores() const
+{
+    return workers_.size();
+}
+
+IoQueue& Runtime::getIoQueue(size_t core)
+{
+    assert(core < workers_.size());
+    return *workers_[core]->io;
+}
+
+void Runtime::spawnOn(size_t core, Function<void(IoQueue&)> func)
+{
+    assert(core < workers_.size());
+    auto& worker = *workers_[core];
+    worker.inbox.produce(std::move(func));
+    worker.inboxEventFd.write();
+}
+
+std::vector<Fd> Runtime::createListenSockets(
+    const IpAddressPort& listenAddress, int backlog, bool steerToCpu)
+{
+    std::vector<Fd> sockets;
+    for (size_t i = 0; i < workers_.size(); ++i) {
+        auto socket = createTcpListenSocket(listenAddress, backlog, true);
+        if (socket == -1) {
+            return {};
+        }
+        sockets.push_back(std::move(socket));
+    }
+
+    if (!steerToCpu) {
+        return sockets;
+    }
+
+    // Socket i is served by the thread of core i, which is pinned to the i-th allowed CPU, which
+    // is not necessarily CPU i.
+    std::vector<int> socketCpus;
+    for (const auto& worker : workers_) {
+        socketCpus.push_back(worker->cpu);
+    }
+    const auto pinned
+        = std::none_of(socketCpus.begin(), socketCpus.end(), [](int cpu) { return cpu == -1; });
+    // The program is shared by the whole group, so it's enough to attach it to one socket
+    const auto attached = pinned ? attachReusePortCpuSteering(sockets[0], socketCpus)
+                                 : attachReusePortCpuSteering(sockets[0], sockets.size());
+    if (!attached) {
+        return {};
+    }
+    return sockets;
+}
+
+void Runtime::onStop(size_t core, Function<void(IoQueue&)> handler)
+{
+    assert(core < workers_.size());
+    workers_[core]->stopHandlers.push_back(std::move(handler));
+}
+
+void Runtime::stop()
+{
+    stopRequested_.store(true);
+    for (auto& worker : workers_) {
+        worker->inboxEventFd.write();
+    }
+}
+
+void Runtime::join()
+{
+    for (auto& worker : workers_) {
+        if (worker->thread.joinable()) {
+            worker->thread.join();
+        }
+    }
+}
+
+void Runtime::workerFunc(Worker& worker, int cpu, std::latch& started)
+{
+    if (cpu >= 0) {
+        pinCurrentThread(cpu);
+    }
+    worker.io = std::make_unique<IoQueue>(options_.ioQueue);
+    processInbox(worker);
+    started.count_down();
+
+    worker.io->run();
+}
+
+BasicCoroutine Runtime::processInbox(Worker& worker)
+{
+    while (true) {
+        const auto res = co_await worker.inboxEventFd.read(*worker.io);
+        if (!res) {
+            getLogger().log(LogSeverity::Fatal,
+                "Error reading from eventfd in Runtime: " + res.error().message());
+            std::abort();
+        }
+
+        // MpscQueue::consume might return nullopt while a producer is not done yet, but that
+        // producer will write to the eventfd afterwards, so we will get to it.
+        while (auto func = worker.inbox.consume()) {
+            (*func)(*worker.io);
+        }
+
+        if (stopRequested_.load()) {
+            for (const auto& handler : worker.stopHandlers) {
+                handler(*worker.io);
+            }
+            worker.stopHandlers.clear();
+            worker.io->stop();
+            co_return;
+        }
+    }
+}
+}
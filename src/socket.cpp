@@ -1,9 +1,12 @@
 #include "aiopp/socket.hpp"
 
+#include <cassert>
 #include <charconv>
 #include <cstring>
+#include <vector>
 
 #include <arpa/inet.h>
+#include <linux/filter.h>
 
 #include "aiopp/log.hpp"
 #include "aiopp/util.hpp"
@@ -84,7 +87,8 @@ Fd createSocket(SocketType type)
     return socket;
 }
 
-Fd createSocket(SocketType type, const IpAddressPort& bindAddress, bool reuseAddr)
+Fd createSocket(
+    SocketType type, const IpAddressPort& bindAddress, bool reuseAddr, bool reusePort)
 {
     auto socket = createSocket(type);
     if (socket == -1) {
@@ -99,6 +103,14 @@ Fd createSocket(SocketType type, const IpAddressPort& bindAddress, bool reuseAdd
         }
     }
 
+    if (reusePort) {
+        const int reuse = 1;
+        if (::setsockopt(socket, SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof(reuse)) == -1) {
+            getLogger().log(LogSeverity::Error, "Could not set sockopt SO_REUSEPORT");
+            return Fd {};
+        }
+    }
+
     if (!bind(socket, bindAddress)) {
         return Fd {};
     }
@@ -131,9 +143,9 @@ Fd createUdpSocket(const IpAddressPort& bindAddress)
     return fd;
 }
 
-Fd createTcpListenSocket(const IpAddressPort& listenAddress, int backlog)
+Fd createTcpListenSocket(const IpAddressPort& listenAddress, int backlog, bool reusePort)
 {
-    auto socket = createSocket(SocketType::Tcp, listenAddress, true);
+    auto socket = createSocket(SocketType::Tcp, listenAddress, true, reusePort);
     if (socket == -1) {
         return socket;
     }
@@ -145,4 +157,54 @@ Fd createTcpListenSocket(const IpAddressPort& listenAddress, int backlog)
 
     return socket;
 }
+
+namespace {
+    bool attachReusePortProgram(const Fd& socket, std::vector<::sock_filter>& code)
+    {
+        const ::sock_fprog prog { static_cast<unsigned short>(code.size()), code.data() };
+        if (::setsockopt(socket, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog))
+            == -1) {
+            getLogger().log(LogSeverity::Error,
+                "Could not attach reuseport steering program: " + errnoToString(errno));
+            return false;
+        }
+        return true;
+    }
+}
+
+bool attachReusePortCpuSteering(const Fd& socket, size_t numSockets)
+{
+    assert(numSockets > 0);
+    // A = cpu; A %= numSockets; return A
+    std::vector<::sock_filter> code {
+        { BPF_LD | BPF_W | BPF_ABS, 0, 0, static_cast<uint32_t>(SKF_AD_OFF + SKF_AD_CPU) },
+        { BPF_ALU | BPF_MOD | BPF_K, 0, 0, static_cast<uint32_t>(numSockets) },
+        { BPF_RET | BPF_A, 0, 0, 0 },
+    };
+    return attachReusePortProgram(socket, code);
+}
+
+bool attachReusePortCpuSteering(const Fd& socket, std::span<const int> socketCpus)
+{
+    assert(!socketCpus.empty());
+    // Classic BPF has no tables, so this is a chain of comparisons:
+    // A = cpu; if (A == socketCpus[0]) return 0; ...; A %= numSockets; return A
+    // A CPU that serves multiple sockets only gets the first one.
+    std::vector<::sock_filter> code;
+    code.push_back(
+        { BPF_LD | BPF_W | BPF_ABS, 0, 0, static_cast<uint32_t>(SKF_AD_OFF + SKF_AD_CPU) });
+    for (size_t i = 0; i < socketCpus.size(); ++i) {
+        assert(socketCpus[i] >= 0);
+        // On a match skip nothing (jt = 0) and return, otherwise skip the return (jf = 1)
+        code.push_back({ BPF_JMP | BPF_JEQ | BPF_K, 0, 1, static_cast<uint32_t>(socketCpus[i]) });
+        code.push_back({ BPF_RET | BPF_K, 0, 0, static_cast<uint32_t>(i) });
+    }
+    code.push_back({ BPF_ALU | BPF_MOD | BPF_K, 0, 0, static_cast<uint32_t>(socketCpus.size()) });
+    code.push_back({ BPF_RET | BPF_A, 0, 0, 0 });
+    if (code.size() > BPF_MAXINSNS) {
+        getLogger().log(LogSeverity::Error, "Too many sockets for reuseport steering program");
+        return false;
+    }
+    return attachReusePortProgram(socket, code);
+}
 }
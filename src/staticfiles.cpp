@@ -0,0 +1,221 @@
+#include "aiopp/staticfiles.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <utility>
+
+#include <fcntl.h>
+#include <linux/openat2.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "aiopp/proxy.hpp"
+
+namespace aiopp {
+OpenFileCache::OpenFileCache(IoQueue& io, Fd rootDir, size_t capacity, Clock::duration maxAge)
+    : io_(io)
+    , rootDir_(std::move(rootDir))
+    , capacity_(capacity)
+    , maxAge_(maxAge)
+{
+}
+
+Task<Result<OpenFileCache::FilePtr>> OpenFileCache::get(std::string path)
+{
+    auto it = entries_.find(path);
+    if (it != entries_.end()) {
+        if (Clock::now() - it->second->openedAt < maxAge_) {
+            lru_.splice(lru_.begin(), lru_, it->second);
+            co_return it->second->file;
+        }
+        lru_.erase(it->second);
+        entries_.erase(it);
+    }
+
+    const auto openedAt = Clock::now();
+    auto file = co_await open(path);
+    if (!file || capacity_ == 0) {
+        co_return file;
+    }
+
+    // Another get for the same path might have finished while we were waiting
+    it = entries_.find(path);
+    if (it != entries_.end()) {
+        lru_.splice(lru_.begin(), lru_, it->second);
+        co_return it->second->file;
+    }
+
+    lru_.push_front(Entry { path, *file, openedAt });
+    entries_.emplace(std::move(path), lru_.begin());
+    if (lru_.size() > capacity_) {
+        entries_.erase(lru_.back().path);
+        lru_.pop_back();
+    }
+    co_return file;
+}
+
+void OpenFileCache::clear()
+{
+    entries_.clear();
+    lru_.clear();
+}
+
+Task<Result<OpenFileCache::FilePtr>> OpenFileCache::open(const std::string& path)
+{
+    ::open_how how {};
+    how.flags = O_RDONLY | O_CLOEXEC;
+    how.resolve = RESOLVE_BENEATH | RESOLVE_NO_MAGICLINKS;
+    const auto fd = co_await io_.openat2(rootDir_, path.c_str(), &how);
+    if (!fd) {
+        co_return error(fd.error());
+    }
+
+    auto file = std::make_shared<OpenFile>();
+    file->fd.reset(*fd);
+
+    struct ::statx st;
+    constexpr auto mask = STATX_TYPE | STATX_SIZE | STATX_MTIME;
+    const auto res = co_await io_.statx(file->fd, "", AT_EMPTY_PATH, mask, &st);
+    if (!res) {
+        co_return error(res.error());
+    }
+    if (S_ISDIR(st.stx_mode)) {
+        co_return error(std::make_error_code(std::errc::is_a_directory));
+    }
+    if (!S_ISREG(st.stx_mode)) {
+        co_return error(std::make_error_code(std::errc::permission_denied));
+    }
+    file->size = st.stx_size;
+    file->mtime = st.stx_mtime;
+    co_return FilePtr(std::move(file));
+}
+
+FileSender::FileSender(
+    IoQueue& io, PipePool& pipes, RegisteredBufferPool* buffers, size_t chunkSize)
+    : io_(io)
+    , pipes_(pipes)
+    , buffers_(buffers)
+    , chunkSize_(chunkSize)
+{
+    assert(chunkSize_ > 0);
+}
+
+Task<Result<uint64_t>> FileSender::send(AnyFd socket, const OpenFile& file, std::string_view header)
+{
+    if (buffers_ && header.size() + file.size <= buffers_->getChunkSize()) {
+        auto buffer = buffers_->acquire();
+        if (buffer) {
+            co_return co_await sendBuffered(socket, file, header, std::move(buffer));
+        }
+    }
+    co_return co_await sendSpliced(socket, file, header);
+}
+
+Task<Result<uint64_t>> FileSender::sendBuffered(
+    AnyFd socket, const OpenFile& file, std::string_view header, RegisteredBuffer buffer)
+{
+    const auto size = static_cast<size_t>(file.size);
+    const auto total = header.size() + size;
+    std::memcpy(buffer.data(), header.data(), header.size());
+
+    auto chain = io_.chain<2>();
+    chain.add(io_.readFixed(file.fd, buffer, header.size(), size, 0));
+    chain.add(io_.sendFixed(socket, buffer, total));
+    const auto [readRes, sendRes] = co_await chain;
+    if (!readRes) {
+        co_return error(readRes.error());
+    }
+    if (static_cast<size_t>(*readRes) != size) {
+        // The file was truncated after it was opened
+        co_return error(std::make_error_code(std::errc::io_error));
+    }
+    if (!sendRes) {
+        co_return error(sendRes.error());
+    }
+
+    auto sent = static_cast<size_t>(*sendRes);
+    while (sent < total) {
+        const auto res = co_await io_.send(socket, buffer.data() + sent, total - sent);
+        if (!res) {
+            co_return error(res.error());
+        }
+        if (*res == 0) {
+            co_return error(std::make_error_code(std::errc::broken_pipe));
+        }
+        sent += static_cast<size_t>(*res);
+    }
+    co_return static_cast<uint64_t>(total);
+}
+
+Task<Result<uint64_t>> FileSender::sendSpliced(
+    AnyFd socket, const OpenFile& file, std::string_view header)
+{
+    // With MSG_MORE the header waits for the file contents, so they go out in full segments.
+    // Otherwise Nagle's algorithm holds back the file until the client acknowledged the header,
+    // which it might delay for tens of milliseconds.
+    size_t headerSent = 0;
+    while (headerSent < header.size()) {
+        ::iovec iov { const_cast<char*>(header.data()) + headerSent, header.size() - headerSent };
+        ::msghdr msg {};
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        const auto res = co_await io_.sendmsg(socket, &msg, file.size > 0 ? MSG_MORE : 0);
+        if (!res) {
+            co_return error(res.error());
+        }
+        if (*res == 0) {
+            co_return error(std::make_error_code(std::errc::broken_pipe));
+        }
+        headerSent += static_cast<size_t>(*res);
+    }
+
+    auto pipe = pipes_.acquire();
+    if (!pipe) {
+        co_return error(std::make_error_code(std::errc::too_many_files_open));
+    }
+
+    // Invariant: The pipe is empty at the start of every iteration
+    uint64_t offset = 0;
+    while (offset < file.size) {
+        const auto len = static_cast<size_t>(std::min<uint64_t>(chunkSize_, file.size - offset));
+        // Hard linked, so a short first splice (which counts as a failure for IOSQE_IO_LINK)
+        // does not cancel the second one, which moves whatever is in the pipe.
+        auto chain = io_.chain<2>(true);
+        chain.add(io_.splice(
+            file.fd, static_cast<int64_t>(offset), pipe->write, -1, len, SPLICE_F_MOVE));
+        chain.add(io_.splice(pipe->read, -1, socket, -1, len, SPLICE_F_MOVE));
+
+        // If the first splice failed or the file was truncated, the pipe stays empty and the
+        // second one would wait forever, so it is canceled.
+        const auto read = co_await chain.step(0);
+        if (!read || *read == 0) {
+            chain.cancel();
+        }
+
+        const auto [in, out] = co_await chain;
+        if (!in) {
+            co_return error(in.error());
+        }
+        if (*in == 0) {
+            pipes_.release(std::move(*pipe));
+            co_return error(std::make_error_code(std::errc::io_error));
+        }
+        if (!out) {
+            // The pipe might not be empty, so it is not reused
+            co_return error(out.error());
+        }
+        if (*out < *in) {
+            const auto drained
+                = co_await spliceAll(io_, pipe->read, socket, static_cast<size_t>(*in - *out));
+            if (!drained) {
+                co_return error(drained.error());
+            }
+        }
+        offset += static_cast<uint64_t>(*in);
+    }
+
+    pipes_.release(std::move(*pipe));
+    co_return static_cast<uint64_t>(header.size()) + file.size;
+}
+}
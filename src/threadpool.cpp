@@ -1,45 +1,190 @@
 #include "aiopp/threadpool.hpp"
 
 #include <algorithm>
+#include <cassert>
+
+#include "aiopp/workstealingdeque.hpp"
 
 namespace aiopp {
-ThreadPool::ThreadPool(size_t numThreads)
+namespace {
+    // How many rounds an idle worker looks for work before it parks
+    constexpr size_t SpinRounds = 64;
+    // How many jobs a worker moves from the overflow queue to its own deque at once
+    constexpr size_t OverflowBatchSize = 64;
+
+    struct CurrentWorker {
+        const ThreadPool* pool = nullptr;
+        size_t index = 0;
+    };
+
+    thread_local CurrentWorker currentWorker;
+}
+
+struct ThreadPool::Worker {
+    WorkStealingDeque<Job> deque;
+    std::thread thread;
+    uint32_t rng = 0;
+};
+
+ThreadPool::ThreadPool(size_t numThreads, size_t injectorCapacity)
+    : injector_(injectorCapacity)
 {
     running_.store(true);
-    for (size_t i = 0; i < std::max(1ul, numThreads); ++i) {
-        threads_.push_back(std::thread(&ThreadPool::workerFunc, this));
+    const auto num = std::max(1ul, numThreads);
+    for (size_t i = 0; i < num; ++i) {
+        workers_.push_back(std::make_unique<Worker>());
+        workers_.back()->rng = static_cast<uint32_t>(i + 1);
+    }
+    // Start the threads after all workers exist, because they steal from each other.
+    for (size_t i = 0; i < num; ++i) {
+        workers_[i]->thread = std::thread(&ThreadPool::workerFunc, this, i);
     }
 }
 
 ThreadPool::~ThreadPool()
 {
     running_.store(false);
-    tasksCv_.notify_all();
-    for (auto& thread : threads_) {
-        thread.join();
+    parkSemaphore_.release(static_cast<ptrdiff_t>(workers_.size()));
+    for (auto& worker : workers_) {
+        worker->thread.join();
+    }
+
+    // Like before, jobs that have not been started yet are dropped (fromRaw destroys them here)
+    for (auto& worker : workers_) {
+        while (auto job = worker->deque.pop()) {
+            Function<void()>::fromRaw(job);
+        }
+    }
+    while (auto job = injector_.consume()) {
+        Function<void()>::fromRaw(*job);
+    }
+    while (!overflow_.empty()) {
+        Function<void()>::fromRaw(overflow_.front());
+        overflow_.pop();
     }
 }
 
 void ThreadPool::push(Function<void()> task)
 {
-    {
-        std::lock_guard lock(tasksMutex_);
-        tasks_.push(std::move(task));
+    assert(task);
+    auto job = task.release();
+    if (currentWorker.pool == this) {
+        workers_[currentWorker.index]->deque.push(job);
+    } else if (!injector_.tryProduce(std::move(job))) {
+        std::lock_guard lock(overflowMutex_);
+        overflow_.push(job);
+        overflowSize_.fetch_add(1);
+    }
+    wakeOne();
+}
+
+void ThreadPool::wakeOne()
+{
+    // Pairs with the fence in park: Either we see the parked worker or it sees the new job.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    // Claim one of the parked workers and wake it
+    auto numParked = numParked_.load();
+    while (numParked > 0 && !numParked_.compare_exchange_weak(numParked, numParked - 1)) { }
+    if (numParked > 0) {
+        parkSemaphore_.release();
+    }
+}
+
+void ThreadPool::park()
+{
+    numParked_.fetch_add(1);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (hasJobs() || !running_.load()) {
+        // Unregister again. If a pusher claimed us in the meantime, we have to consume the token
+        // it released for us.
+        auto numParked = numParked_.load();
+        while (numParked > 0 && !numParked_.compare_exchange_weak(numParked, numParked - 1)) { }
+        if (numParked == 0) {
+            parkSemaphore_.acquire();
+        }
+        return;
+    }
+    parkSemaphore_.acquire();
+}
+
+bool ThreadPool::hasJobs() const
+{
+    if (!injector_.empty() || overflowSize_.load() > 0) {
+        return true;
     }
-    tasksCv_.notify_one();
+    return std::any_of(workers_.begin(), workers_.end(),
+        [](const std::unique_ptr<Worker>& worker) { return !worker->deque.empty(); });
 }
 
-void ThreadPool::workerFunc()
+ThreadPool::Job* ThreadPool::findJob(Worker& worker)
 {
+    if (auto job = worker.deque.pop()) {
+        return job;
+    }
+
+    if (auto job = injector_.consume()) {
+        return *job;
+    }
+
+    if (overflowSize_.load() > 0) {
+        // Take a whole batch, so we don't have to lock for every job. Other workers can steal
+        // from our deque, if we took too many.
+        std::lock_guard lock(overflowMutex_);
+        Job* job = nullptr;
+        size_t num = 0;
+        while (!overflow_.empty() && num < OverflowBatchSize) {
+            if (job) {
+                worker.deque.push(overflow_.front());
+            } else {
+                job = overflow_.front();
+            }
+            overflow_.pop();
+            num++;
+        }
+        overflowSize_.fetch_sub(num);
+        if (job) {
+            return job;
+        }
+    }
+
+    // Start at a random victim, so not all thieves go for the same one
+    worker.rng ^= worker.rng << 13;
+    worker.rng ^= worker.rng >> 17;
+    worker.rng ^= worker.rng << 5;
+    const auto start = worker.rng % workers_.size();
+    for (size_t i = 0; i < workers_.size(); ++i) {
+        auto& victim = *workers_[(start + i) % workers_.size()];
+        if (&victim == &worker) {
+            continue;
+        }
+        if (auto job = victim.deque.steal()) {
+            return job;
+        }
+    }
+    return nullptr;
+}
+
+void ThreadPool::workerFunc(size_t index)
+{
+    currentWorker = CurrentWorker { this, index };
+    auto& worker = *workers_[index];
+    size_t idleRounds = 0;
     while (running_.load()) {
-        std::unique_lock lock(tasksMutex_);
-        tasksCv_.wait(lock, [this] { return !tasks_.empty() || !running_.load(); });
-        if (running_.load()) {
-            auto task = std::move(tasks_.front());
-            tasks_.pop();
-            lock.unlock();
-            task();
+        auto job = findJob(worker);
+        if (job) {
+            idleRounds = 0;
+            Function<void()>::fromRaw(job)();
+            continue;
         }
+
+        if (idleRounds < SpinRounds) {
+            idleRounds++;
+            std::this_thread::yield();
+            continue;
+        }
+
+        park();
+        idleRounds = 0;
     }
 }
 
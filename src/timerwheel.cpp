@@ -0,0 +1,231 @@
+#include "aiopp/timerwheel.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <utility>
+
+namespace aiopp {
+Timer::Timer(Function<void()> callback)
+    : callback_(std::move(callback))
+{
+}
+
+Timer::~Timer()
+{
+    cancel();
+}
+
+void Timer::setCallback(Function<void()> callback)
+{
+    callback_ = std::move(callback);
+}
+
+void Timer::cancel()
+{
+    if (wheel_) {
+        wheel_->cancel(*this);
+    }
+}
+
+void Timer::expired()
+{
+    if (callback_) {
+        callback_();
+    }
+}
+
+TimerWheel::TimerWheel(Clock::duration tickDuration, Clock::time_point start)
+    : tickDuration_(tickDuration)
+    , start_(start)
+{
+    assert(tickDuration_.count() > 0);
+}
+
+TimerWheel::~TimerWheel()
+{
+    // Disarm all timers, so they don't try to cancel themselves later
+    for (size_t level = 0; level < NumLevels; ++level) {
+        for (size_t slot = 0; slot < NumSlots; ++slot) {
+            for (auto timer = slots_[level][slot]; timer; timer = timer->next_) {
+                timer->wheel_ = nullptr;
+            }
+        }
+    }
+}
+
+uint64_t TimerWheel::getTick(Clock::time_point time) const
+{
+    if (time <= start_) {
+        return 0;
+    }
+    const auto ticks = (time - start_ + tickDuration_ - Clock::duration(1)) / tickDuration_;
+    return static_cast<uint64_t>(ticks);
+}
+
+TimerWheel::Clock::time_point TimerWheel::getTime(uint64_t tick) const
+{
+    return start_ + tickDuration_ * tick;
+}
+
+uint64_t TimerWheel::arm(Timer& timer, Clock::time_point deadline)
+{
+    if (timer.wheel_) {
+        timer.wheel_->cancel(timer);
+    }
+    // Timers that are due already expire with the next tick
+    timer.expiry_ = std::max(getTick(deadline), currentTick_ + 1);
+    timer.wheel_ = this;
+    insert(timer);
+    size_++;
+    return timer.expiry_;
+}
+
+void TimerWheel::cancel(Timer& timer)
+{
+    assert(timer.wheel_ == this);
+    unlink(timer);
+    timer.wheel_ = nullptr;
+    size_--;
+}
+
+void TimerWheel::advance(Clock::time_point now)
+{
+    // Round down, so we only process ticks that have passed completely
+    const auto target = now > start_ ? static_cast<uint64_t>((now - start_) / tickDuration_) : 0;
+    while (currentTick_ < target) {
+        tick();
+    }
+}
+
+std::optional<uint64_t> TimerWheel::getNextTick() const
+{
+    if (size_ == 0) {
+        return std::nullopt;
+    }
+
+    std::optional<uint64_t> next;
+
+    // Timers on level 0 expire within the next NumSlots - 1 ticks
+    if (levelSizes_[0] > 0) {
+        for (uint64_t tick = currentTick_ + 1; tick < currentTick_ + NumSlots; ++tick) {
+            if (slots_[0][tick & SlotMask]) {
+                next = tick;
+                break;
+            }
+        }
+    }
+
+    // We also need to wake up when the next non-empty slot of a higher level is emptied, even if
+    // there is a timer on level 0, because the timers moved down might expire before it.
+    // Ticks in between are still processed by advance, but nothing happens in them.
+    for (size_t level = 1; level < NumLevels; ++level) {
+        if (levelSizes_[level] == 0) {
+            continue;
+        }
+        const auto shift = LevelBits * level;
+        for (uint64_t i = 1; i <= NumSlots; ++i) {
+            const auto slotStart = ((currentTick_ >> shift) + i) << shift;
+            if (slots_[level][(slotStart >> shift) & SlotMask]) {
+                next = next ? std::min(*next, slotStart) : slotStart;
+                break;
+            }
+        }
+    }
+    assert(next);
+    return next;
+}
+
+void TimerWheel::insert(Timer& timer)
+{
+    // When timers are moved down in tick, some expire in the current tick. They end up in the
+    // level 0 slot that is processed right afterwards.
+    assert(timer.expiry_ >= currentTick_);
+    const auto delta = timer.expiry_ - currentTick_;
+    size_t level = 0;
+    while (level < NumLevels - 1 && delta >= (uint64_t(1) << (LevelBits * (level + 1)))) {
+        level++;
+    }
+    // Timers that are too far away are put into the last slot they can reach. They are then simply
+    // moved around again until they expire (see tick).
+    const auto maxExpiry = currentTick_ + (uint64_t(1) << (LevelBits * NumLevels)) - 1;
+    const auto expiry = std::min(timer.expiry_, maxExpiry);
+    const auto slot = (expiry >> (LevelBits * level)) & SlotMask;
+
+    auto& head = slots_[level][slot];
+    timer.list_ = &head;
+    timer.prev_ = nullptr;
+    timer.next_ = head;
+    if (head) {
+        head->prev_ = &timer;
+    }
+    head = &timer;
+    timer.level_ = static_cast<uint8_t>(level);
+    levelSizes_[level]++;
+}
+
+void TimerWheel::unlink(Timer& timer)
+{
+    if (timer.prev_) {
+        timer.prev_->next_ = timer.next_;
+    } else {
+        *timer.list_ = timer.next_;
+    }
+    if (timer.next_) {
+        timer.next_->prev_ = timer.prev_;
+    }
+    if (timer.level_ != DetachedLevel) {
+        levelSizes_[timer.level_]--;
+    }
+    timer.list_ = nullptr;
+    timer.prev_ = nullptr;
+    timer.next_ = nullptr;
+}
+
+Timer* TimerWheel::detachSlot(size_t level, size_t slot)
+{
+    auto head = std::exchange(slots_[level][slot], nullptr);
+    for (auto timer = head; timer; timer = timer->next_) {
+        timer->level_ = DetachedLevel;
+        levelSizes_[level]--;
+    }
+    return head;
+}
+
+void TimerWheel::tick()
+{
+    currentTick_++;
+
+    // Move timers down, starting with the highest level, so timers that are moved from level 2 to
+    // level 1, are moved on to level 0 if that level 1 slot is emptied now too.
+    for (size_t level = NumLevels - 1; level > 0; --level) {
+        const auto levelMask = (uint64_t(1) << (LevelBits * level)) - 1;
+        if ((currentTick_ & levelMask) != 0) {
+            continue;
+        }
+        const auto slot = (currentTick_ >> (LevelBits * level)) & SlotMask;
+        auto list = detachSlot(level, slot);
+        for (auto timer = list; timer; timer = list) {
+            list = timer->next_;
+            insert(*timer);
+        }
+    }
+
+    // The expired timers are kept in a local list, so the callbacks may cancel any of them.
+    auto expiring = detachSlot(0, currentTick_ & SlotMask);
+    for (auto timer = expiring; timer; timer = timer->next_) {
+        timer->list_ = &expiring;
+    }
+    while (expiring) {
+        auto& timer = *expiring;
+        unlink(timer);
+        if (timer.expiry_ > currentTick_) {
+            // It was too far away to fit into the wheel
+            insert(timer);
+            continue;
+        }
+        timer.wheel_ = nullptr;
+        size_--;
+        timer.expired();
+    }
+}
+}
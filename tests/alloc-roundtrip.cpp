@@ -0,0 +1,144 @@
+// Counts heap allocations per round trip of the echo loop from echo-tcp-coro (a recv with a
+// deadline followed by sendAll with a timeout), but over a socket pair, so it does not need a
+// client. The client uses a Task for every round trip as well. Task frames are recycled (see
+// framepool.hpp) and the timers live in the timer wheel, so after warming up there must not be a
+// single allocation. Exits with 1 if there were any.
+// Usage: test-alloc-roundtrip [round trips]
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <string_view>
+#include <system_error>
+#include <utility>
+
+#include <sys/socket.h>
+
+#include "aiopp/basiccoroutine.hpp"
+#include "aiopp/framepool.hpp"
+#include "aiopp/ioqueue.hpp"
+#include "aiopp/task.hpp"
+
+using namespace aiopp;
+
+namespace {
+std::atomic<size_t> numAllocations { 0 };
+}
+
+void* operator new(size_t size)
+{
+    numAllocations.fetch_add(1, std::memory_order_relaxed);
+    if (auto ptr = std::malloc(size)) {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept
+{
+    std::free(ptr);
+}
+
+constexpr auto timeout = std::chrono::milliseconds(5000);
+
+// Same as in echo-tcp-coro
+Task<std::pair<std::error_code, bool>> sendAll(IoQueue& io, int socket, std::string_view buffer)
+{
+    size_t offset = 0;
+    while (offset < buffer.size()) {
+        const auto sentBytes
+            = co_await io.send(socket, buffer.data() + offset, buffer.size() - offset);
+        if (!sentBytes) {
+            co_return std::make_pair(sentBytes.error(), false);
+        }
+        if (*sentBytes == 0) {
+            co_return std::make_pair(std::error_code {}, true);
+        }
+        offset += *sentBytes;
+    }
+    co_return std::make_pair(std::error_code {}, false);
+}
+
+// The loop of echo-tcp-coro, except that the receive buffer is on the stack and there is no logging
+BasicCoroutine echo(IoQueue& io, int socket)
+{
+    char buffer[64];
+    while (true) {
+        const auto receivedBytes
+            = co_await io.withDeadline(io.recv(socket, buffer, sizeof(buffer)), timeout);
+        if (!receivedBytes || *receivedBytes == 0) {
+            break;
+        }
+        const auto sendRes = co_await withTimeout(io,
+            sendAll(io, socket, std::string_view(buffer, static_cast<size_t>(*receivedBytes))),
+            timeout);
+        if (!sendRes || sendRes->first || sendRes->second) {
+            break;
+        }
+    }
+    co_await io.close(socket);
+}
+
+Task<bool> roundTrip(IoQueue& io, int socket)
+{
+    const char msg[] = "Hello!";
+    char buffer[64];
+    const auto sentBytes = co_await io.send(socket, msg, sizeof(msg));
+    const auto receivedBytes = co_await io.recv(socket, buffer, sizeof(buffer));
+    co_return sentBytes && receivedBytes;
+}
+
+BasicCoroutine client(IoQueue& io, int socket, size_t numRoundTrips, size_t& allocations)
+{
+    // The first round trips grow the frame pool, the completer map, etc.
+    constexpr size_t numWarmupRoundTrips = 100;
+    size_t allocationsBefore = 0;
+    for (size_t i = 0; i < numWarmupRoundTrips + numRoundTrips; ++i) {
+        if (i == numWarmupRoundTrips) {
+            allocationsBefore = numAllocations.load();
+        }
+        if (!co_await roundTrip(io, socket)) {
+            std::fprintf(stderr, "Error in round trip\n");
+            std::exit(1);
+        }
+    }
+    allocations = numAllocations.load() - allocationsBefore;
+    std::printf("%zu allocations in %zu round trips (%f per round trip)\n", allocations,
+        numRoundTrips, static_cast<double>(allocations) / numRoundTrips);
+    const auto stats = getFramePoolStats();
+    std::printf("Frame pool: %zu hits, %zu misses (%.1f%% hit rate), %zu bytes held\n", stats.hits,
+        stats.misses, stats.hitRate() * 100.0, stats.bytesHeld);
+    co_await io.shutdown(socket, SHUT_WR);
+    co_await io.close(socket);
+}
+
+int main(int argc, char** argv)
+{
+    const size_t numRoundTrips = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 100'000;
+
+    int fds[2];
+    if (::socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == -1) {
+        std::perror("socketpair");
+        return 1;
+    }
+
+    size_t allocations = 0;
+    {
+        IoQueue io;
+        echo(io, fds[0]);
+        client(io, fds[1], numRoundTrips, allocations);
+        io.run();
+    }
+    if (allocations > 0) {
+        std::fprintf(stderr, "Expected no allocations\n");
+        return 1;
+    }
+    return 0;
+}
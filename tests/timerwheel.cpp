@@ -0,0 +1,55 @@
+// Checks that getNextTick does not skip the moving down of timers from higher levels.
+// Returns 1 if a check fails.
+
+#include <chrono>
+#include <cstdio>
+
+#include "aiopp/timerwheel.hpp"
+
+using namespace aiopp;
+
+#define CHECK(expr)                                                                                \
+    if (!(expr)) {                                                                                 \
+        std::fprintf(stderr, "%s:%d: Check failed: %s\n", __FILE__, __LINE__, #expr);              \
+        return 1;                                                                                  \
+    }
+
+struct TestTimer : public Timer {
+    TimerWheel& wheel;
+    uint64_t expiredAt = 0;
+
+    TestTimer(TimerWheel& wheel)
+        : wheel(wheel)
+    {
+    }
+
+    void expired() override { expiredAt = wheel.getCurrentTick(); }
+};
+
+int main()
+{
+    const auto start = TimerWheel::Clock::now();
+    const auto at = [start](uint64_t tick) { return start + std::chrono::milliseconds(tick); };
+    TimerWheel wheel(std::chrono::milliseconds(1), start);
+
+    // A is armed 260 ticks ahead, so it goes to level 1 and is moved down at tick 256
+    wheel.advance(at(100));
+    TestTimer a(wheel);
+    CHECK(wheel.arm(a, at(360)) == 360);
+
+    // B is on level 0 and expires after A
+    wheel.advance(at(200));
+    TestTimer b(wheel);
+    CHECK(wheel.arm(b, at(450)) == 450);
+
+    CHECK(wheel.getNextTick() == 256);
+    wheel.advance(at(256));
+    CHECK(wheel.getNextTick() == 360);
+    wheel.advance(at(360));
+    CHECK(a.expiredAt == 360);
+    CHECK(wheel.getNextTick() == 450);
+    wheel.advance(at(450));
+    CHECK(b.expiredAt == 450);
+    CHECK(!wheel.getNextTick());
+    CHECK(wheel.size() == 0);
+}